@@ -1,14 +1,43 @@
 #include "../parser.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstring>
 #include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <new>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+// Every heap allocation is counted so each mode can report how many it makes
+// per iteration
+static std::atomic<std::size_t> g_allocations(0);
+
+// Neither is inlined, so GCC does not pair malloc() and free() with the
+// operator new and delete calls they stand in for
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void *operator new(std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
 namespace {
 
 struct Workload {
@@ -24,6 +53,7 @@ struct Result {
   double best_ms;
   double bytes_per_second;
   std::size_t checksum;
+  std::size_t allocations;
 };
 
 volatile std::size_t g_sink = 0;
@@ -93,6 +123,30 @@ auto make_huge_fields(std::size_t rows, std::size_t field_size) -> std::string {
   return out;
 }
 
+// id,amount,ratio,day: integer and floating point columns for the typed
+// modes
+auto make_numeric_rows(std::size_t rows) -> std::string {
+  std::string out;
+  out.reserve(rows * 48);
+
+  for (std::size_t row = 0; row < rows; ++row) {
+    out += std::to_string(row * 7919);
+    out += ',';
+    out += std::to_string(static_cast<long long>(row % 1000) - 500);
+    out += '.';
+    out += std::to_string(row % 100);
+    out += ',';
+    out += std::to_string(row % 97);
+    out += "e-3,2024-0";
+    out += static_cast<char>('1' + row % 9);
+    out += "-1";
+    out += static_cast<char>('0' + row % 10);
+    out += '\n';
+  }
+
+  return out;
+}
+
 auto workloads() -> std::vector<Workload> {
   std::vector<Workload> out;
   out.push_back({"plain", make_plain_rows(50000, 12)});
@@ -103,8 +157,7 @@ auto workloads() -> std::vector<Workload> {
 }
 
 auto parse_fields(const std::string &csv) -> std::size_t {
-  std::istringstream input(csv);
-  aria::csv::CsvParser parser(input);
+  aria::csv::CsvParser parser(csv.data(), csv.size());
 
   std::size_t checksum = 0;
   for (;;) {
@@ -120,9 +173,201 @@ auto parse_fields(const std::string &csv) -> std::size_t {
 }
 
 auto parse_rows(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+
+  std::size_t checksum = 0;
+  for (const auto &row : parser) {
+    checksum += row.size();
+    for (const auto &field : row) {
+      checksum += field.size();
+    }
+  }
+
+  return checksum;
+}
+
+// Same checksum as parse_rows, with every row read into one reused arena
+auto parse_rows_arena(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+  aria::csv::ArenaRow row;
+
+  std::size_t checksum = 0;
+  while (parser.next_row(row)) {
+    checksum += row.size();
+    for (std::size_t i = 0; i < row.size(); ++i) {
+      checksum += row[i].size;
+    }
+  }
+
+  return checksum;
+}
+
+// Same checksum as parse_rows, from a visitor that parse() calls per field
+struct ChecksumVisitor {
+  std::size_t checksum = 0;
+  std::size_t fields = 0;
+
+  void on_field(const char *, std::size_t size) {
+    checksum += size;
+    ++fields;
+  }
+  void on_row_end() {
+    checksum += fields;
+    fields = 0;
+  }
+};
+
+auto parse_rows_visitor(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+  ChecksumVisitor visitor;
+  parser.parse(visitor);
+  return visitor.checksum;
+}
+
+// Same checksum as parse_rows, from batches of 1024 fields
+auto parse_field_batches(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+  std::vector<aria::csv::FieldView> fields(1024);
+
+  std::size_t checksum = 0;
+  std::size_t row_fields = 0;
+  std::size_t count = 0;
+  while ((count = parser.next_fields(fields.data(), fields.size())) != 0) {
+    for (std::size_t i = 0; i < count; ++i) {
+      if (fields[i].type == aria::csv::FieldType::DATA) {
+        checksum += fields[i].size;
+        row_fields++;
+      } else {
+        checksum += row_fields;
+        row_fields = 0;
+      }
+    }
+  }
+
+  return checksum;
+}
+
+auto parse_field_views(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+
+  std::size_t checksum = 0;
+  for (;;) {
+    const auto field = parser.next_field_view();
+    if (field.type == aria::csv::FieldType::CSV_END) {
+      break;
+    }
+    checksum += static_cast<std::size_t>(field.type);
+    checksum += field.size;
+  }
+
+  return checksum;
+}
+
+// parse_field_views reading through a stream, which copies the text into
+// the parser's input buffer a buffer at a time
+auto parse_stream_field_views(const std::string &csv) -> std::size_t {
   std::istringstream input(csv);
   aria::csv::CsvParser parser(input);
 
+  std::size_t checksum = 0;
+  for (;;) {
+    const auto field = parser.next_field_view();
+    if (field.type == aria::csv::FieldType::CSV_END) {
+      break;
+    }
+    checksum += static_cast<std::size_t>(field.type);
+    checksum += field.size;
+  }
+
+  return checksum;
+}
+
+// parse_field_views reading through a MemorySource, which copies like a
+// stream but without the stream
+auto parse_source_field_views(const std::string &csv) -> std::size_t {
+  aria::csv::MemorySource source(csv.data(), csv.size());
+  aria::csv::CsvParser parser(source);
+
+  std::size_t checksum = 0;
+  for (;;) {
+    const auto field = parser.next_field_view();
+    if (field.type == aria::csv::FieldType::CSV_END) {
+      break;
+    }
+    checksum += static_cast<std::size_t>(field.type);
+    checksum += field.size;
+  }
+
+  return checksum;
+}
+
+// A source that hands out 64 KiB per read after 100us of pretend I/O
+// latency, like a cold disk or a network volume
+auto make_slow_source(const std::string &csv)
+    -> std::unique_ptr<aria::csv::Source> {
+  std::size_t offset = 0;
+  return std::unique_ptr<aria::csv::Source>(new aria::csv::CallbackSource(
+      [&csv, offset](char *buffer, std::size_t size) mutable -> std::size_t {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        const std::size_t count =
+            std::min(std::min(size, csv.size() - offset),
+                     static_cast<std::size_t>(64 * 1024));
+        std::copy(csv.data() + offset, csv.data() + offset + count, buffer);
+        offset += count;
+        return count;
+      }));
+}
+
+auto count_field_views(aria::csv::CsvParser &parser) -> std::size_t {
+  std::size_t checksum = 0;
+  for (;;) {
+    const auto field = parser.next_field_view();
+    if (field.type == aria::csv::FieldType::CSV_END) {
+      break;
+    }
+    checksum += static_cast<std::size_t>(field.type);
+    checksum += field.size;
+  }
+
+  return checksum;
+}
+
+// count_field_views over a PushParser fed 16 KiB chunks, the way data comes
+// off a socket
+auto parse_push_chunks(const std::string &csv) -> std::size_t {
+  static constexpr std::size_t CHUNK = 16 * 1024;
+  aria::csv::PushParser parser;
+  std::size_t checksum = 0;
+  const auto count = [&checksum](const aria::csv::FieldView &field) {
+    if (field.type != aria::csv::FieldType::CSV_END) {
+      checksum += static_cast<std::size_t>(field.type);
+      checksum += field.size;
+    }
+  };
+  for (std::size_t offset = 0; offset < csv.size(); offset += CHUNK) {
+    parser.feed(csv.data() + offset, std::min(CHUNK, csv.size() - offset),
+                count);
+  }
+  parser.finish(count);
+  return checksum;
+}
+
+auto parse_slow_field_views(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(make_slow_source(csv));
+  return count_field_views(parser);
+}
+
+auto parse_read_ahead_field_views(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(std::unique_ptr<aria::csv::Source>(
+      new aria::csv::ReadAheadSource(make_slow_source(csv))));
+  return count_field_views(parser);
+}
+
+// parse_rows with only columns 0, 5 and 10 selected
+auto parse_rows_projected(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser =
+      aria::csv::CsvParser(csv.data(), csv.size()).select_columns({0, 5, 10});
+
   std::size_t checksum = 0;
   for (const auto &row : parser) {
     checksum += row.size();
@@ -134,11 +379,350 @@ auto parse_rows(const std::string &csv) -> std::size_t {
   return checksum;
 }
 
+auto count_rows(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+  return static_cast<std::size_t>(parser.count_rows());
+}
+
+auto count_rows_parallel(const std::string &csv) -> std::size_t {
+  return static_cast<std::size_t>(
+      aria::csv::ParallelReader(csv.data(), csv.size()).count_rows());
+}
+
+// Builds a row index with a checkpoint every 1024 rows
+auto build_row_index(const std::string &csv) -> std::size_t {
+  const auto index = aria::csv::RowIndex::build(csv.data(), csv.size());
+  return static_cast<std::size_t>(index.rows());
+}
+
+#if defined(ARIA_CSV_WITH_ZLIB)
+auto gzip(const std::string &csv) -> std::string {
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string output(deflateBound(&stream, csv.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(csv.data()));
+  stream.avail_in = static_cast<uInt>(csv.size());
+  stream.next_out = reinterpret_cast<Bytef *>(&output[0]);
+  stream.avail_out = static_cast<uInt>(output.size());
+  deflate(&stream, Z_FINISH);
+  output.resize(stream.total_out);
+  deflateEnd(&stream);
+  return output;
+}
+
+// parse_field_views of a gzip copy of the workload, inflated either on the
+// parsing thread or on a read-ahead thread
+auto parse_gzip_field_views(const std::string &compressed, bool read_ahead)
+    -> std::size_t {
+  std::unique_ptr<aria::csv::Source> input =
+      aria::csv::decompressing_source(std::unique_ptr<aria::csv::Source>(
+          new aria::csv::MemorySource(compressed.data(), compressed.size())));
+  if (read_ahead) {
+    input.reset(new aria::csv::ReadAheadSource(std::move(input)));
+  }
+  aria::csv::CsvParser parser(std::move(input));
+  return count_field_views(parser);
+}
+#endif
+
+// parse_field_views through a MemorySource with the read size between min
+// and max; equal sizes make it fixed
+auto parse_buffered_field_views(const std::string &csv, std::size_t min,
+                                std::size_t max) -> std::size_t {
+  aria::csv::MemorySource source(csv.data(), csv.size());
+  aria::csv::CsvParser parser =
+      aria::csv::CsvParser(source).adaptive_buffer_size(min, max);
+  return count_field_views(parser);
+}
+
+// parse_field_views with the default dialect fixed at compile time
+auto parse_fixed_field_views(const std::string &csv) -> std::size_t {
+  aria::csv::BasicCsvParser<aria::csv::FixedDialect<>> parser(csv.data(),
+                                                              csv.size());
+
+  std::size_t checksum = 0;
+  for (;;) {
+    const auto field = parser.next_field_view();
+    if (field.type == aria::csv::FieldType::CSV_END) {
+      break;
+    }
+    checksum += static_cast<std::size_t>(field.type);
+    checksum += field.size;
+  }
+
+  return checksum;
+}
+
+auto parse_indexed_field_views(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser =
+      aria::csv::CsvParser(csv.data(), csv.size())
+          .engine(aria::csv::Engine::STRUCTURAL_INDEX);
+
+  std::size_t checksum = 0;
+  for (;;) {
+    const auto field = parser.next_field_view();
+    if (field.type == aria::csv::FieldType::CSV_END) {
+      break;
+    }
+    checksum += static_cast<std::size_t>(field.type);
+    checksum += field.size;
+  }
+
+  return checksum;
+}
+
+// Same checksum as parse_rows, but built from field views so no field is
+// ever copied out of the parser.
+auto parse_row_views(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+
+  std::size_t checksum = 0;
+  std::size_t row_fields = 0;
+  for (;;) {
+    const auto field = parser.next_field_view();
+    if (field.type == aria::csv::FieldType::DATA) {
+      checksum += field.size;
+      row_fields++;
+      continue;
+    }
+    if (field.type == aria::csv::FieldType::CSV_END && row_fields == 0) {
+      break;
+    }
+    checksum += row_fields;
+    row_fields = 0;
+    if (field.type == aria::csv::FieldType::CSV_END) {
+      break;
+    }
+  }
+
+  return checksum;
+}
+
+auto parse_rows_parallel(const std::string &csv) -> std::size_t {
+  std::size_t checksum = 0;
+  aria::csv::ParallelReader(csv.data(), csv.size())
+      .chunk_size(512 * 1024)
+      .for_each_row([&](const aria::csv::RowTag &,
+                        const aria::csv::RowView &row) {
+        checksum += row.size();
+        for (const auto &field : row) {
+          checksum += field.size;
+        }
+      });
+
+  return checksum;
+}
+
+// Field bytes plus row count, read through 1024-row column batches. Short
+// rows are padded in a batch, so this doesn't match the rows checksum.
+auto parse_columns(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+  aria::csv::ColumnBatch batch;
+
+  std::size_t checksum = 0;
+  while (parser.next_batch(batch, 1024) != 0) {
+    checksum += batch.rows();
+    for (std::size_t col = 0; col < batch.columns(); ++col) {
+      checksum += batch.column(col).chars.size();
+    }
+  }
+
+  return checksum;
+}
+
+// Numeric workload read as strings and converted by hand, the way callers
+// did before TypedReader
+auto parse_numeric_strings(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+
+  double checksum = 0;
+  for (const auto &row : parser) {
+    checksum += static_cast<double>(std::stoll(row[0]));
+    checksum += std::stod(row[1]) + std::stod(row[2]);
+    checksum += static_cast<double>(row[3].size());
+  }
+
+  return static_cast<std::size_t>(checksum);
+}
+
+auto read_rows(const std::string &csv) -> aria::csv::CSV {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+  aria::csv::CSV rows;
+  for (const auto &row : parser) {
+    rows.push_back(row);
+  }
+  return rows;
+}
+
+// Writes already parsed rows with operator<< per field, quoting like
+// CsvWriter does; checksums the output size
+auto write_ostream(const aria::csv::CSV &rows) -> std::size_t {
+  std::ostringstream out;
+  for (const auto &row : rows) {
+    for (std::size_t column = 0; column < row.size(); ++column) {
+      if (column != 0) {
+        out << ',';
+      }
+      const std::string &field = row[column];
+      if (field.find_first_of(",\"\r\n") == std::string::npos &&
+          (!field.empty() || row.size() != 1)) {
+        out << field;
+        continue;
+      }
+      out << '"';
+      for (const char c : field) {
+        if (c == '"') {
+          out << '"';
+        }
+        out << c;
+      }
+      out << '"';
+    }
+    out << "\r\n";
+  }
+  return out.str().size();
+}
+
+// write_ostream through CsvWriter
+auto write_csv_writer(const aria::csv::CSV &rows) -> std::size_t {
+  std::ostringstream out;
+  {
+    aria::csv::CsvWriter writer(out);
+    for (const auto &row : rows) {
+      writer.write_row(row);
+    }
+  }
+  return out.str().size();
+}
+
+// Parses field views and writes them straight back out, the way a
+// transform that leaves most fields alone does; checksums the output size
+auto transform_views(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+  std::size_t checksum = 0;
+  aria::csv::CsvWriter writer(
+      [&checksum](const char *, std::size_t size) { checksum += size; });
+  // A last row that ends the input comes back without a ROW_END
+  for (bool in_row = false;;) {
+    const auto field = parser.next_field_view();
+    if (field.type == aria::csv::FieldType::DATA) {
+      writer.write_field(field);
+      in_row = true;
+    } else if (field.type == aria::csv::FieldType::ROW_END || in_row) {
+      writer.end_row();
+      in_row = false;
+    }
+    if (field.type == aria::csv::FieldType::CSV_END) {
+      break;
+    }
+  }
+  writer.flush();
+  return checksum;
+}
+
+// Looks up two columns of every numeric row by name through a map built for
+// each row, the way callers have had to without header support
+auto named_map(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+
+  std::vector<std::string> header;
+  std::size_t checksum = 0;
+  for (const auto &row : parser) {
+    if (header.empty()) {
+      header = row;
+      continue;
+    }
+    std::unordered_map<std::string, std::string> named;
+    for (std::size_t column = 0; column < row.size(); ++column) {
+      named[header[column]] = row[column];
+    }
+    checksum += named["amount"].size() + named["day"].size();
+  }
+
+  return checksum;
+}
+
+// named_map through named_rows()
+auto named_rows(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+
+  std::size_t checksum = 0;
+  for (const auto &row : parser.named_rows()) {
+    checksum += row["amount"].size() + row["day"].size();
+  }
+
+  return checksum;
+}
+
+// named_rows with only the two columns selected by name
+auto named_rows_projected(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser =
+      aria::csv::CsvParser(csv.data(), csv.size())
+          .select_columns(std::vector<std::string>{"amount", "day"});
+
+  std::size_t checksum = 0;
+  for (const auto &row : parser.named_rows()) {
+    checksum += row["amount"].size() + row["day"].size();
+  }
+
+  return checksum;
+}
+
+// Keeps the numeric rows with an amount in [-500, -451], about 5% of them,
+// by testing every row after it has been read
+auto filter_after_parse(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+
+  std::size_t checksum = 0;
+  for (const auto &row : parser) {
+    const double amount = std::strtod(row[1].c_str(), nullptr);
+    if (amount >= -500 && amount <= -451) {
+      checksum += row.size() + row[0].size() + row[3].size();
+    }
+  }
+
+  return checksum;
+}
+
+// filter_after_parse with the test pushed into the parser by where()
+auto filter_pushdown(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser =
+      aria::csv::CsvParser(csv.data(), csv.size())
+          .where(1, aria::csv::Predicate::between(-500, -451));
+
+  std::size_t checksum = 0;
+  for (const auto &row : parser) {
+    checksum += row.size() + row[0].size() + row[3].size();
+  }
+
+  return checksum;
+}
+
+auto parse_numeric_typed(const std::string &csv) -> std::size_t {
+  aria::csv::CsvParser parser(csv.data(), csv.size());
+  aria::csv::TypedReader reader(
+      parser, {aria::csv::ColumnType::INT64, aria::csv::ColumnType::DOUBLE,
+               aria::csv::ColumnType::DOUBLE, aria::csv::ColumnType::DATE});
+
+  double checksum = 0;
+  std::vector<aria::csv::TypedValue> row;
+  while (reader.next_row(row)) {
+    checksum += static_cast<double>(row[0].integer);
+    checksum += row[1].real + row[2].real;
+    checksum += 10.0;
+  }
+
+  return static_cast<std::size_t>(checksum);
+}
+
 template <typename Fn>
 auto time_best(const Workload &workload, const std::string &mode, int iterations,
                Fn fn) -> Result {
   double best_ms = 0.0;
   std::size_t checksum = 0;
+  const std::size_t allocations = g_allocations.load();
 
   for (int i = 0; i < iterations; ++i) {
     const auto start = std::chrono::steady_clock::now();
@@ -160,11 +744,13 @@ auto time_best(const Workload &workload, const std::string &mode, int iterations
           iterations,
           best_ms,
           static_cast<double>(workload.csv.size()) / seconds,
-          checksum};
+          checksum,
+          (g_allocations.load() - allocations) / iterations};
 }
 
 void print_header() {
-  std::cout << "workload,mode,bytes,iterations,best_ms,mb_per_s,checksum\n";
+  std::cout
+      << "workload,mode,bytes,iterations,best_ms,mb_per_s,checksum,allocs\n";
 }
 
 void print_result(const Result &result) {
@@ -173,7 +759,7 @@ void print_result(const Result &result) {
             << std::setprecision(3) << result.best_ms << ','
             << std::setprecision(2)
             << (result.bytes_per_second / (1024.0 * 1024.0)) << ','
-            << result.checksum << '\n';
+            << result.checksum << ',' << result.allocations << '\n';
 }
 
 } // namespace
@@ -190,5 +776,89 @@ int main(int argc, char **argv) {
   for (const auto &workload : data) {
     print_result(time_best(workload, "fields", iterations, parse_fields));
     print_result(time_best(workload, "rows", iterations, parse_rows));
+    print_result(
+        time_best(workload, "rows-arena", iterations, parse_rows_arena));
+    print_result(
+        time_best(workload, "rows-visitor", iterations, parse_rows_visitor));
+    print_result(
+        time_best(workload, "fields-view", iterations, parse_field_views));
+    print_result(
+        time_best(workload, "fields-batch", iterations, parse_field_batches));
+    print_result(time_best(workload, "fields-view-stream", iterations,
+                           parse_stream_field_views));
+    print_result(time_best(workload, "fields-view-source", iterations,
+                           parse_source_field_views));
+    print_result(time_best(workload, "fields-view-slow-io", iterations,
+                           parse_slow_field_views));
+    print_result(time_best(workload, "fields-view-read-ahead", iterations,
+                           parse_read_ahead_field_views));
+    print_result(
+        time_best(workload, "push-chunks", iterations, parse_push_chunks));
+    const std::size_t sweep[] = {4, 16, 64, 128, 1024, 4096};
+    for (const auto kib : sweep) {
+      print_result(time_best(
+          workload, "buffer-" + std::to_string(kib) + "k", iterations,
+          [kib](const std::string &csv) {
+            return parse_buffered_field_views(csv, kib * 1024, kib * 1024);
+          }));
+    }
+    print_result(time_best(workload, "buffer-adaptive", iterations,
+                           [](const std::string &csv) {
+                             return parse_buffered_field_views(
+                                 csv, 4 * 1024, 4096 * 1024);
+                           }));
+    print_result(time_best(workload, "fields-view-fixed", iterations,
+                           parse_fixed_field_views));
+    print_result(time_best(workload, "rows-view", iterations, parse_row_views));
+    print_result(time_best(workload, "fields-view-indexed", iterations,
+                           parse_indexed_field_views));
+    print_result(
+        time_best(workload, "rows-parallel", iterations, parse_rows_parallel));
+    print_result(time_best(workload, "columns", iterations, parse_columns));
+    print_result(time_best(workload, "rows-projected", iterations,
+                           parse_rows_projected));
+    print_result(
+        time_best(workload, "row-index", iterations, build_row_index));
+    print_result(time_best(workload, "count-rows", iterations, count_rows));
+    print_result(time_best(workload, "count-rows-parallel", iterations,
+                           count_rows_parallel));
+    const aria::csv::CSV rows = read_rows(workload.csv);
+    print_result(time_best(workload, "write-ostream", iterations,
+                           [&rows](const std::string &) {
+                             return write_ostream(rows);
+                           }));
+    print_result(time_best(workload, "write-csv-writer", iterations,
+                           [&rows](const std::string &) {
+                             return write_csv_writer(rows);
+                           }));
+    print_result(
+        time_best(workload, "transform-views", iterations, transform_views));
+#if defined(ARIA_CSV_WITH_ZLIB)
+    const std::string compressed = gzip(workload.csv);
+    print_result(time_best(workload, "gzip-inline", iterations,
+                           [&compressed](const std::string &) {
+                             return parse_gzip_field_views(compressed, false);
+                           }));
+    print_result(time_best(workload, "gzip-read-ahead", iterations,
+                           [&compressed](const std::string &) {
+                             return parse_gzip_field_views(compressed, true);
+                           }));
+#endif
   }
+
+  const Workload numeric = {"numeric", make_numeric_rows(200000)};
+  print_result(
+      time_best(numeric, "numeric-strings", iterations, parse_numeric_strings));
+  print_result(
+      time_best(numeric, "numeric-typed", iterations, parse_numeric_typed));
+  print_result(
+      time_best(numeric, "filter-after-parse", iterations, filter_after_parse));
+  print_result(
+      time_best(numeric, "filter-pushdown", iterations, filter_pushdown));
+
+  const Workload headed = {"headed", "id,amount,ratio,day\n" + numeric.csv};
+  print_result(time_best(headed, "named-map", iterations, named_map));
+  print_result(time_best(headed, "named-rows", iterations, named_rows));
+  print_result(time_best(headed, "named-rows-projected", iterations,
+                         named_rows_projected));
 }
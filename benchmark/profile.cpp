@@ -4,7 +4,6 @@
 #include <fstream>
 #include <iostream>
 #include <iterator>
-#include <sstream>
 #include <stdexcept>
 #include <string>
 
@@ -23,8 +22,7 @@ auto read_file(const char *path) -> std::string {
 }
 
 auto parse_fields(const std::string &input) -> std::size_t {
-  std::istringstream stream(input);
-  aria::csv::CsvParser parser(stream);
+  aria::csv::CsvParser parser(input.data(), input.size());
 
   std::size_t fields = 0;
   for (;;) {
@@ -56,12 +56,13 @@ def run_optimize(binary, iterations):
 def print_generated_results(rows):
     print("Generated workload benchmark")
     print()
-    print("| workload | mode | bytes | iterations | best ms | MiB/s | checksum |")
-    print("| --- | --- | ---: | ---: | ---: | ---: | ---: |")
+    print("| workload | mode | bytes | iterations | best ms | MiB/s | checksum "
+          "| allocs |")
+    print("| --- | --- | ---: | ---: | ---: | ---: | ---: | ---: |")
     for row in rows:
       print(
           "| {workload} | {mode} | {bytes} | {iterations} | {best_ms} | "
-          "{mb_per_s} | {checksum} |".format(**row)
+          "{mb_per_s} | {checksum} | {allocs} |".format(**row)
       )
 
 
@@ -1,30 +1,49 @@
 #include "../parser.hpp"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <sstream>
 #include <string>
 
 extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
-  std::string input(reinterpret_cast<const char *>(data), size);
-  std::istringstream stream(input);
-
+  // Fields are parsed in place, rows through a stream so that both input
+  // paths get fuzzed
   try {
-    aria::csv::CsvParser parser(stream);
-    for (;;) {
+    const auto *text = reinterpret_cast<const char *>(data);
+    aria::csv::CsvParser parser(text, size);
+    // A push parser fed 7 bytes at a time has to return the same fields
+    aria::csv::PushParser push;
+    const auto same_field = [&parser](const aria::csv::FieldView &pushed) {
       const auto field = parser.next_field();
-      if (field.type == aria::csv::FieldType::CSV_END) {
-        break;
+      if (field.type != pushed.type ||
+          (field.type == aria::csv::FieldType::DATA &&
+           field.data.compare(0, field.data.size(), pushed.data,
+                              pushed.size) != 0)) {
+        std::abort();
       }
+    };
+    for (size_t offset = 0; offset < size; offset += 7) {
+      push.feed(text + offset, std::min<size_t>(7, size - offset), same_field);
     }
+    push.finish(same_field);
   } catch (...) {
   }
 
+  std::string input(reinterpret_cast<const char *>(data), size);
   std::istringstream row_stream(input);
   try {
     aria::csv::CsvParser parser(row_stream);
+    uint64_t rows = 0;
     for (const auto &row : parser) {
       (void)row;
+      rows++;
+    }
+    // Counting without fields has to agree with the iterator
+    aria::csv::CsvParser counter(input.data(), input.size());
+    if (counter.count_rows() != rows) {
+      std::abort();
     }
   } catch (...) {
   }
@@ -2,19 +2,104 @@
 #define ARIA_CSV_H
 
 #include <cstddef>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <functional>
+#include <initializer_list>
 #include <istream>
 #include <iterator>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ARIA_CSV_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// GCC and Clang can compile AVX2/AVX-512 functions without raising the
+// baseline, so those are picked at runtime instead of at build time
+#if defined(ARIA_CSV_HAS_SSE2) && defined(__GNUC__) &&                         \
+    (defined(__x86_64__) || defined(__i386__))
+#define ARIA_CSV_HAS_CPU_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+#if defined(__PCLMUL__) && defined(__x86_64__)
+#define ARIA_CSV_HAS_CLMUL 1
+#include <wmmintrin.h>
+#endif
+
+// Byte order for the SWAR digit parsing
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) ||  \
+    defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64)
+#define ARIA_CSV_LITTLE_ENDIAN 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ARIA_CSV_HAS_MMAP 1
+#define ARIA_CSV_HAS_FD 1
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Rows can also be read from C++20 coroutines; the rest of the header
+// stays C++11
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define ARIA_CSV_HAS_COROUTINES 1
+#include <coroutine>
+#endif
+#endif
+
+// Doubles that parse_double() can't compute exactly go to strtod, which
+// reads the decimal point of the global locale unless given the C locale
+#if defined(_WIN32)
+#define ARIA_CSV_HAS_STRTOD_L 1
+#include <locale.h>
+#elif defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+#define ARIA_CSV_HAS_STRTOD_L 1
+#include <locale.h>
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#include <xlocale.h>
+#endif
+#else
+#include <clocale>
+#endif
+
+// Compressed input needs the codec libraries, so each one is opt-in: define
+// the macro (the CMake options ARIA_CSV_WITH_* do) and link the library
+#if defined(ARIA_CSV_WITH_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(ARIA_CSV_WITH_ZSTD)
+#include <zstd.h>
+#endif
+#if defined(ARIA_CSV_WITH_LZ4)
+#include <lz4frame.h>
+#endif
+
 namespace aria {
 namespace csv {
 enum class Term { CRLF = -2 };
 enum class FieldType { DATA, ROW_END, CSV_END };
+enum class Engine { STATE_MACHINE, STRUCTURAL_INDEX };
 using CSV = std::vector<std::vector<std::string>>;
 
 // Checking for '\n', '\r', and '\r\n' by default
@@ -29,6 +114,649 @@ inline auto operator==(const char c, const Term t) -> bool {
 
 inline auto operator!=(const char c, const Term t) -> bool { return !(c == t); }
 
+namespace detail {
+// Finds the first byte in [first, last) equal to any of a, b or c. Used to
+// find the end of an unquoted field, where the stops are the delimiter and
+// the terminator bytes.
+using StopScanner = const char *(*)(const char *, const char *, char, char,
+                                    char);
+
+inline auto scan_stops_scalar(const char *first, const char *last,
+                              const char a, const char b, const char c)
+    -> const char * {
+  for (; first != last; ++first) {
+    const char ch = *first;
+    if (ch == a || ch == b || ch == c) {
+      break;
+    }
+  }
+  return first;
+}
+
+inline auto lowest_set_bit(const uint64_t mask) -> unsigned {
+#if defined(__GNUC__)
+  return static_cast<unsigned>(__builtin_ctzll(mask));
+#else
+  unsigned bit = 0;
+  while (((mask >> bit) & 1U) == 0) {
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+#if defined(ARIA_CSV_HAS_SSE2)
+inline auto scan_stops_sse2(const char *first, const char *last, const char a,
+                            const char b, const char c) -> const char * {
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  const __m128i vc = _mm_set1_epi8(c);
+  while (last - first >= 16) {
+    const __m128i chunk =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+    const __m128i hits =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, va),
+                                  _mm_cmpeq_epi8(chunk, vb)),
+                     _mm_cmpeq_epi8(chunk, vc));
+    const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+    if (mask != 0) {
+      return first + lowest_set_bit(mask);
+    }
+    first += 16;
+  }
+  return scan_stops_scalar(first, last, a, b, c);
+}
+#endif
+
+#if defined(ARIA_CSV_HAS_CPU_DISPATCH)
+__attribute__((target("avx2"))) inline auto
+scan_stops_avx2(const char *first, const char *last, const char a,
+                const char b, const char c) -> const char * {
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+  const __m256i vc = _mm256_set1_epi8(c);
+  while (last - first >= 32) {
+    const __m256i chunk =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+    const __m256i hits =
+        _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, va),
+                                        _mm256_cmpeq_epi8(chunk, vb)),
+                        _mm256_cmpeq_epi8(chunk, vc));
+    const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+    if (mask != 0) {
+      return first + lowest_set_bit(mask);
+    }
+    first += 32;
+  }
+  return scan_stops_sse2(first, last, a, b, c);
+}
+
+// Masked loads never touch bytes outside the mask, so the tail of the
+// range needs no scalar loop here.
+__attribute__((target("avx512bw"))) inline auto
+scan_stops_avx512(const char *first, const char *last, const char a,
+                  const char b, const char c) -> const char * {
+  const __m512i va = _mm512_set1_epi8(a);
+  const __m512i vb = _mm512_set1_epi8(b);
+  const __m512i vc = _mm512_set1_epi8(c);
+  while (first < last) {
+    const auto remaining = static_cast<size_t>(last - first);
+    const __mmask64 valid =
+        remaining >= 64 ? ~__mmask64(0) : (__mmask64(1) << remaining) - 1;
+    const __m512i chunk = _mm512_maskz_loadu_epi8(valid, first);
+    const __mmask64 hits = (_mm512_cmpeq_epi8_mask(chunk, va) |
+                            _mm512_cmpeq_epi8_mask(chunk, vb) |
+                            _mm512_cmpeq_epi8_mask(chunk, vc)) &
+                           valid;
+    if (hits != 0) {
+      return first + lowest_set_bit(hits);
+    }
+    first += remaining >= 64 ? 64 : remaining;
+  }
+  return last;
+}
+#endif
+
+// Every scanner the running CPU supports, fastest last
+inline auto available_stop_scanners() -> std::vector<StopScanner> {
+  std::vector<StopScanner> scanners{scan_stops_scalar};
+#if defined(ARIA_CSV_HAS_SSE2)
+  scanners.push_back(scan_stops_sse2);
+#endif
+#if defined(ARIA_CSV_HAS_CPU_DISPATCH)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    scanners.push_back(scan_stops_avx2);
+  }
+  if (__builtin_cpu_supports("avx512bw")) {
+    scanners.push_back(scan_stops_avx512);
+  }
+#endif
+  return scanners;
+}
+
+inline auto stop_scanner() -> StopScanner {
+  static const StopScanner scanner = available_stop_scanners().back();
+  return scanner;
+}
+
+// Quote and separator bits for one 64 byte block, bit i is byte i
+struct BlockMasks {
+  uint64_t quotes;
+  uint64_t separators;
+};
+
+inline auto classify_block_scalar(const char *block, const size_t size,
+                                  const char quote, const char delimiter,
+                                  const char term, const char other_term)
+    -> BlockMasks {
+  BlockMasks masks{0, 0};
+  for (size_t i = 0; i < size; ++i) {
+    const char c = block[i];
+    if (c == quote) {
+      masks.quotes |= uint64_t(1) << i;
+    } else if (c == delimiter || c == term || c == other_term) {
+      masks.separators |= uint64_t(1) << i;
+    }
+  }
+  return masks;
+}
+
+inline auto classify_block(const char *block, const size_t size,
+                           const char quote, const char delimiter,
+                           const char term, const char other_term)
+    -> BlockMasks {
+#if defined(ARIA_CSV_HAS_SSE2)
+  if (size == 64) {
+    const __m128i vq = _mm_set1_epi8(quote);
+    const __m128i vd = _mm_set1_epi8(delimiter);
+    const __m128i vt = _mm_set1_epi8(term);
+    const __m128i vo = _mm_set1_epi8(other_term);
+    BlockMasks masks{0, 0};
+    for (int i = 0; i < 4; ++i) {
+      const __m128i chunk =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i * 16));
+      const __m128i seps =
+          _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, vd),
+                                    _mm_cmpeq_epi8(chunk, vt)),
+                       _mm_cmpeq_epi8(chunk, vo));
+      const auto q = static_cast<uint32_t>(
+          _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, vq)));
+      const auto sep = static_cast<uint32_t>(_mm_movemask_epi8(seps));
+      masks.quotes |= uint64_t(q) << (i * 16);
+      masks.separators |= uint64_t(sep) << (i * 16);
+    }
+    return masks;
+  }
+#endif
+  return classify_block_scalar(block, size, quote, delimiter, term,
+                               other_term);
+}
+
+// Bit i of the result is the parity of the quotes in bits 0..i, i.e. a
+// carry-less multiply by all ones
+inline auto prefix_xor(uint64_t bits) -> uint64_t {
+#if defined(ARIA_CSV_HAS_CLMUL)
+  const __m128i product = _mm_clmulepi64_si128(
+      _mm_set_epi64x(0, static_cast<long long>(bits)), _mm_set1_epi8(-1), 0);
+  return static_cast<uint64_t>(_mm_cvtsi128_si64(product));
+#else
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+#endif
+}
+
+// Stage one of the structural index engine. Bitmaps over a window of the
+// input buffer that starts at the beginning of a field, with quoted regions
+// found from quote parity and masked out of the separators.
+//
+// Quote parity only matches the state machine while every opening quote
+// starts a field (or continues an escaped quote). The first quote that
+// doesn't, like the one in a"b, ends the trusted part of the window.
+struct StructuralIndex {
+  static constexpr size_t WINDOW = 64 * 1024;
+
+  size_t begin = 0;
+  size_t end = 0;
+  size_t trusted_end = 0;
+  std::vector<uint64_t> quotes;
+  std::vector<uint64_t> separators;
+
+  void build(const char *data, const size_t first, const size_t last,
+             const char quote, const char delimiter, const char term,
+             const char other_term) {
+    begin = first;
+    end = last;
+    trusted_end = last;
+    quotes.assign((last - first + 63) / 64, 0);
+    separators.assign(quotes.size(), 0);
+    if (quote == delimiter || quote == term || quote == other_term) {
+      trusted_end = first;
+      return;
+    }
+
+    uint64_t in_quotes = 0;
+    uint64_t prev_separator = 1;
+    uint64_t prev_quote = 0;
+    for (size_t word = 0; word < quotes.size(); ++word) {
+      const size_t offset = first + word * 64;
+      const size_t size = last - offset < 64 ? last - offset : 64;
+      const uint64_t valid =
+          size == 64 ? ~uint64_t(0) : (uint64_t(1) << size) - 1;
+      const BlockMasks masks = classify_block(data + offset, size, quote,
+                                              delimiter, term, other_term);
+
+      const uint64_t quoted = (prefix_xor(masks.quotes) ^ in_quotes) & valid;
+      const uint64_t opening = masks.quotes & quoted;
+      const uint64_t allowed = (masks.separators << 1) | prev_separator |
+                               (masks.quotes << 1) | prev_quote;
+      const uint64_t untrusted = opening & ~allowed;
+      if (untrusted != 0) {
+        const unsigned bit = lowest_set_bit(untrusted);
+        const uint64_t before = (uint64_t(1) << bit) - 1;
+        quotes[word] = masks.quotes & before;
+        separators[word] = masks.separators & ~quoted & before;
+        trusted_end = offset + bit;
+        return;
+      }
+
+      quotes[word] = masks.quotes;
+      separators[word] = masks.separators & ~quoted;
+      in_quotes = (quoted >> 63) != 0 ? ~uint64_t(0) : 0;
+      prev_separator = masks.separators >> 63;
+      prev_quote = masks.quotes >> 63;
+    }
+  }
+
+  void clear() {
+    begin = 0;
+    end = 0;
+    trusted_end = 0;
+  }
+
+  auto covers(const size_t offset) const -> bool {
+    return offset >= begin && offset < end;
+  }
+
+  // Offset of the first set bit in [from, to), or `to` if there is none
+  static auto next_bit(const std::vector<uint64_t> &bits, const size_t base,
+                       const size_t from, const size_t to) -> size_t {
+    size_t word = (from - base) / 64;
+    uint64_t current = bits[word] & (~uint64_t(0) << ((from - base) % 64));
+    for (;;) {
+      if (current != 0) {
+        const size_t found = base + word * 64 + lowest_set_bit(current);
+        return found < to ? found : to;
+      }
+      if (base + (++word) * 64 >= to) {
+        return to;
+      }
+      current = bits[word];
+    }
+  }
+
+  auto next_separator(const size_t from) const -> size_t {
+    return from < trusted_end ? next_bit(separators, begin, from, trusted_end)
+                              : trusted_end;
+  }
+
+  auto next_quote(const size_t from, const size_t to) const -> size_t {
+    return from < to ? next_bit(quotes, begin, from, to) : to;
+  }
+};
+#if defined(ARIA_CSV_HAS_MMAP)
+// Read-only mapping of a whole file, hinted for one sequential pass
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Could not open input file");
+    }
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Could not read input file size");
+    }
+
+    m_size = static_cast<size_t>(info.st_size);
+    if (m_size == 0) {
+      ::close(fd);
+      return;
+    }
+
+    void *addr = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+      throw std::runtime_error("Could not map input file");
+    }
+
+    ::madvise(addr, m_size, MADV_SEQUENTIAL);
+#if defined(MADV_HUGEPAGE)
+    ::madvise(addr, m_size, MADV_HUGEPAGE);
+#endif
+    m_data = static_cast<const char *>(addr);
+  }
+
+  ~MappedFile() {
+    if (m_data != nullptr) {
+      ::munmap(const_cast<char *>(m_data), m_size);
+    }
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  auto operator=(const MappedFile &) -> MappedFile & = delete;
+
+  // Only regular files have a size that can be mapped up front. Missing
+  // files also report false so the caller's stream fallback reports them.
+  static auto can_map(const std::string &path) -> bool {
+    struct stat info;
+    return ::stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+  }
+
+  auto data() const -> const char * { return m_data; }
+  auto size() const -> size_t { return m_size; }
+
+private:
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+};
+#endif
+// Conversions used by TypedReader. They parse a field in place and either
+// accept all of it or return false.
+
+#if defined(ARIA_CSV_LITTLE_ENDIAN)
+// SWAR: checks that eight bytes are all digits and combines them into one
+// number with three multiplies instead of eight
+inline auto parse_eight_digits(const char *p, uint64_t &out) -> bool {
+  uint64_t chunk;
+  std::memcpy(&chunk, p, sizeof(chunk));
+  if ((chunk & 0xF0F0F0F0F0F0F0F0ULL) != 0x3030303030303030ULL ||
+      ((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) !=
+          0x3030303030303030ULL) {
+    return false;
+  }
+  chunk -= 0x3030303030303030ULL;
+  chunk = (chunk * 10) + (chunk >> 8);
+  chunk = (((chunk & 0x000000FF000000FFULL) * 0x000F424000000064ULL) +
+           (((chunk >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >>
+          32;
+  out = static_cast<uint32_t>(chunk);
+  return true;
+}
+#endif
+
+// Unsigned digits only, at most 19 of them so the value can't overflow
+inline auto parse_digits(const char *first, const char *last, uint64_t &out)
+    -> bool {
+  uint64_t value = 0;
+#if defined(ARIA_CSV_LITTLE_ENDIAN)
+  uint64_t eight;
+  while (last - first >= 8 && parse_eight_digits(first, eight)) {
+    value = value * 100000000ULL + eight;
+    first += 8;
+  }
+#endif
+  for (; first != last; ++first) {
+    const unsigned digit = static_cast<unsigned char>(*first) - '0';
+    if (digit > 9) {
+      return false;
+    }
+    value = value * 10 + digit;
+  }
+  out = value;
+  return true;
+}
+
+inline auto parse_int64(const char *first, const char *last, int64_t &out)
+    -> bool {
+  const bool negative = first != last && *first == '-';
+  if (first != last && (*first == '-' || *first == '+')) {
+    ++first;
+  }
+  while (last - first > 19 && *first == '0') {
+    ++first;
+  }
+  if (first == last || last - first > 19) {
+    return false;
+  }
+  uint64_t value;
+  if (!parse_digits(first, last, value)) {
+    return false;
+  }
+  // 19 digits can still be past the int64 range
+  const uint64_t limit = negative ? 9223372036854775808ULL
+                                  : 9223372036854775807ULL;
+  if (value > limit) {
+    return false;
+  }
+  out = negative && value != 0 ? -static_cast<int64_t>(value - 1) - 1
+                               : static_cast<int64_t>(value);
+  return true;
+}
+
+#if defined(ARIA_CSV_HAS_STRTOD_L) && defined(_WIN32)
+inline auto c_locale() -> _locale_t {
+  static const _locale_t locale = _create_locale(LC_NUMERIC, "C");
+  return locale;
+}
+#elif defined(ARIA_CSV_HAS_STRTOD_L)
+inline auto c_locale() -> locale_t {
+  static const locale_t locale = newlocale(LC_NUMERIC_MASK, "C", locale_t());
+  return locale;
+}
+#endif
+
+// strtod as in the C locale, with '.' as the decimal point whatever the
+// global locale is
+inline auto c_strtod(const char *first, const char *last) -> double {
+  std::string text(first, last);
+#if defined(ARIA_CSV_HAS_STRTOD_L) && defined(_WIN32)
+  return _strtod_l(text.c_str(), nullptr, c_locale());
+#elif defined(ARIA_CSV_HAS_STRTOD_L)
+  return strtod_l(text.c_str(), nullptr, c_locale());
+#else
+  // Spelled with the locale's decimal point, which is what strtod reads
+  const char point = *std::localeconv()->decimal_point;
+  std::replace(text.begin(), text.end(), '.', point);
+  return std::strtod(text.c_str(), nullptr);
+#endif
+}
+
+// Decimal notation only: [sign] digits [. digits] [e [sign] digits]. Values
+// with at most 19 significant digits and a small exponent are computed
+// exactly from one multiply or divide by a power of ten; anything else falls
+// back to strtod, in the C locale, on the already validated text.
+inline auto parse_double(const char *first, const char *last, double &out)
+    -> bool {
+  static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *const start = first;
+  const bool negative = first != last && *first == '-';
+  if (first != last && (*first == '-' || *first == '+')) {
+    ++first;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int64_t exponent = 0;
+  bool any_digits = false;
+  for (; first != last && static_cast<unsigned>(*first - '0') <= 9; ++first) {
+    any_digits = true;
+    if (digits < 19) {
+      mantissa = mantissa * 10 + static_cast<unsigned>(*first - '0');
+      digits += mantissa != 0;
+    } else {
+      exponent++;
+      digits++;
+    }
+  }
+  if (first != last && *first == '.') {
+    ++first;
+    for (; first != last && static_cast<unsigned>(*first - '0') <= 9;
+         ++first) {
+      any_digits = true;
+      if (digits < 19) {
+        mantissa = mantissa * 10 + static_cast<unsigned>(*first - '0');
+        digits += mantissa != 0;
+        exponent--;
+      } else {
+        digits++;
+      }
+    }
+  }
+  if (!any_digits) {
+    return false;
+  }
+  if (first != last && (*first == 'e' || *first == 'E')) {
+    ++first;
+    const bool negative_exponent = first != last && *first == '-';
+    if (first != last && (*first == '-' || *first == '+')) {
+      ++first;
+    }
+    if (first == last) {
+      return false;
+    }
+    int64_t value = 0;
+    for (; first != last; ++first) {
+      const unsigned digit = static_cast<unsigned char>(*first) - '0';
+      if (digit > 9) {
+        return false;
+      }
+      if (value < 100000) {
+        value = value * 10 + digit;
+      }
+    }
+    exponent += negative_exponent ? -value : value;
+  }
+  if (first != last) {
+    return false;
+  }
+
+  if (digits <= 19 && mantissa <= (1ULL << 53) && exponent >= -22 &&
+      exponent <= 22) {
+    double value = static_cast<double>(mantissa);
+    value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+    out = negative ? -value : value;
+    return true;
+  }
+  out = c_strtod(start, last);
+  return true;
+}
+
+inline auto parse_bool(const char *first, const char *last, bool &out)
+    -> bool {
+  const auto matches = [&](const char *word) {
+    const size_t size = std::strlen(word);
+    if (static_cast<size_t>(last - first) != size) {
+      return false;
+    }
+    for (size_t i = 0; i < size; ++i) {
+      if ((first[i] | 0x20) != word[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  if (matches("true") || (last - first == 1 && *first == '1')) {
+    out = true;
+    return true;
+  }
+  if (matches("false") || (last - first == 1 && *first == '0')) {
+    out = false;
+    return true;
+  }
+  return false;
+}
+
+// Exactly `count` digits
+inline auto parse_fixed(const char *p, int count, int &out) -> bool {
+  int value = 0;
+  for (int i = 0; i < count; ++i) {
+    const unsigned digit = static_cast<unsigned char>(p[i]) - '0';
+    if (digit > 9) {
+      return false;
+    }
+    value = value * 10 + static_cast<int>(digit);
+  }
+  out = value;
+  return true;
+}
+
+// Days from 1970-01-01 in the proleptic Gregorian calendar
+inline auto days_from_civil(int64_t y, int m, int d) -> int64_t {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const int64_t yoe = y - era * 400;
+  const int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// YYYY-MM-DD as days since 1970-01-01
+inline auto parse_date(const char *first, const char *last, int64_t &out)
+    -> bool {
+  static const int month_days[] = {31, 29, 31, 30, 31, 30,
+                                   31, 31, 30, 31, 30, 31};
+  int year, month, day;
+  if (last - first != 10 || first[4] != '-' || first[7] != '-' ||
+      !parse_fixed(first, 4, year) || !parse_fixed(first + 5, 2, month) ||
+      !parse_fixed(first + 8, 2, day) || month < 1 || month > 12 || day < 1 ||
+      day > month_days[month - 1]) {
+    return false;
+  }
+  const bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  if (month == 2 && day == 29 && !leap) {
+    return false;
+  }
+  out = days_from_civil(year, month, day);
+  return true;
+}
+
+// YYYY-MM-DD[T ]HH:MM:SS[.ffffff][Z] in UTC as microseconds since the epoch
+inline auto parse_timestamp(const char *first, const char *last, int64_t &out)
+    -> bool {
+  int64_t days;
+  int hour, minute, second;
+  if (last - first < 19 || !parse_date(first, first + 10, days) ||
+      (first[10] != 'T' && first[10] != ' ') || first[13] != ':' ||
+      first[16] != ':' || !parse_fixed(first + 11, 2, hour) ||
+      !parse_fixed(first + 14, 2, minute) ||
+      !parse_fixed(first + 17, 2, second) || hour > 23 || minute > 59 ||
+      second > 59) {
+    return false;
+  }
+  first += 19;
+  if (last != first && last[-1] == 'Z') {
+    --last;
+  }
+  int64_t micros = 0;
+  if (first != last) {
+    const int fraction = static_cast<int>(last - first) - 1;
+    int value;
+    if (*first != '.' || fraction < 1 || fraction > 6 ||
+        !parse_fixed(first + 1, fraction, value)) {
+      return false;
+    }
+    micros = value;
+    for (int i = fraction; i < 6; ++i) {
+      micros *= 10;
+    }
+  }
+  out = ((days * 24 + hour) * 60 + minute) * 60 + second;
+  out = out * 1000000 + micros;
+  return true;
+}
+} // namespace detail
+
 // Wraps returned fields so we can also indicate
 // that we hit row endings or the end of the csv itself
 struct Field {
@@ -40,395 +768,3910 @@ struct Field {
   std::string data;
 };
 
-// Reads and parses lines from a csv file
-class CsvParser {
-private:
-  // CSV state for state machine
-  enum class State {
-    START_OF_FIELD,
-    IN_FIELD,
-    IN_QUOTED_FIELD,
-    IN_ESCAPED_QUOTE,
-    END_OF_ROW,
-    EMPTY
-  };
-  State m_state = State::START_OF_FIELD;
-
-  // Configurable attributes
-  char m_quote = '"';
-  char m_delimiter = ',';
-  Term m_terminator = Term::CRLF;
-  std::unique_ptr<std::istream> m_owned_input;
-  std::istream *m_input = nullptr;
-
-  // Buffer capacities
-  static constexpr int FIELDBUF_CAP = 1024;
-  static constexpr int INPUTBUF_CAP = 1024 * 128;
+// Non-owning counterpart of Field returned by next_field_view(). The data
+// belongs to the parser and is only valid until it is advanced again.
+struct FieldView {
+  // An array of views for next_fields() can be declared up front
+  FieldView() : type(FieldType::CSV_END) {}
+  explicit FieldView(FieldType t) : type(t) {}
+  FieldView(const char *d, std::size_t n)
+      : type(FieldType::DATA), data(d), size(n) {}
 
-  // Buffers
-  std::string m_fieldbuf{};
-  std::vector<char> m_inputbuf = std::vector<char>(INPUTBUF_CAP);
+  auto str() const -> std::string { return std::string(data, size); }
 
-  // Misc
-  bool m_eof = false;
-  bool m_has_pending_empty_field = false;
-  size_t m_cursor = 0;
-  size_t m_bytes_read = 0;
-  std::streamoff m_scanposition = 0;
+  FieldType type;
+  const char *data = nullptr;
+  std::size_t size = 0;
+};
 
+// A test on a field, attached to a column with BasicCsvParser::where().
+// between() is inclusive and only matches fields that are decimal numbers.
+class Predicate {
 public:
-  // Delete copy constructor and assignment
-  CsvParser(const CsvParser &) = delete;
-  auto operator=(const CsvParser &) -> CsvParser & = delete;
+  static auto equals(std::string value) -> Predicate {
+    return Predicate(Kind::EQUALS, std::move(value), 0, 0);
+  }
 
-  // Allow move operations
-  CsvParser(CsvParser &&) = default;
-  auto operator=(CsvParser &&) -> CsvParser & = default;
+  static auto starts_with(std::string prefix) -> Predicate {
+    return Predicate(Kind::PREFIX, std::move(prefix), 0, 0);
+  }
 
-  // Creates the CSV parser which by default, splits on commas,
-  // uses quotes to escape, and handles CSV files that end in either
-  // '\r', '\n', or '\r\n'.
-  explicit CsvParser(std::istream &input) : m_input(&input) {
-    // Reserve space upfront to improve performance
-    m_fieldbuf.reserve(FIELDBUF_CAP);
-    validate_input();
+  static auto between(const double low, const double high) -> Predicate {
+    return Predicate(Kind::RANGE, std::string(), low, high);
   }
 
-  // Creates a CSV parser that owns the input stream. This is useful when the
-  // parser must outlive the local scope where the stream was created.
-  explicit CsvParser(std::unique_ptr<std::istream> input)
-      : m_owned_input(std::move(input)), m_input(m_owned_input.get()) {
-    m_fieldbuf.reserve(FIELDBUF_CAP);
-    validate_input();
+  auto matches(const char *data, const std::size_t size) const -> bool {
+    switch (m_kind) {
+    case Kind::EQUALS:
+      return size == m_text.size() &&
+             std::equal(m_text.begin(), m_text.end(), data);
+    case Kind::PREFIX:
+      return size >= m_text.size() &&
+             std::equal(m_text.begin(), m_text.end(), data);
+    case Kind::RANGE:
+      break;
+    }
+    double value;
+    return detail::parse_double(data, data + size, value) && value >= m_low &&
+           value <= m_high;
   }
 
-  static auto from_file(const std::string &path) -> CsvParser {
-    std::unique_ptr<std::istream> input(new std::ifstream(path));
-    return CsvParser(std::move(input));
+private:
+  enum class Kind { EQUALS, PREFIX, RANGE };
+
+  Predicate(const Kind kind, std::string text, const double low,
+            const double high)
+      : m_kind(kind), m_text(std::move(text)), m_low(low), m_high(high) {}
+
+  Kind m_kind;
+  std::string m_text;
+  double m_low;
+  double m_high;
+};
+
+// The names of a header row. Names are hashed into an open addressing table
+// once, so looking one up takes the same time for any number of columns and
+// doesn't allocate. A repeated name finds its first column.
+class Header {
+public:
+  Header() = default;
+
+  explicit Header(std::vector<std::string> names) : m_names(std::move(names)) {
+    size_t slots = 4;
+    while (slots < m_names.size() * 2) {
+      slots *= 2;
+    }
+    m_slots.assign(slots, 0);
+    for (size_t column = 0; column < m_names.size(); ++column) {
+      const std::string &name = m_names[column];
+      size_t slot = hash(name.data(), name.size()) & (slots - 1);
+      while (m_slots[slot] != 0 && m_names[m_slots[slot] - 1] != name) {
+        slot = (slot + 1) & (slots - 1);
+      }
+      if (m_slots[slot] == 0) {
+        m_slots[slot] = column + 1;
+      }
+    }
   }
 
-  // Change the quote character
-  auto quote(char c) noexcept -> CsvParser && {
-    m_quote = c;
-    return std::move(*this);
+  auto size() const -> size_t { return m_names.size(); }
+  auto names() const -> const std::vector<std::string> & { return m_names; }
+  auto name(const size_t column) const -> const std::string & {
+    return m_names.at(column);
   }
 
-  // Change the delimiter character
-  auto delimiter(char c) noexcept -> CsvParser && {
-    m_delimiter = c;
-    return std::move(*this);
+  auto contains(const char *name, const size_t size) const -> bool {
+    return find(name, size) != m_names.size();
+  }
+  auto contains(const std::string &name) const -> bool {
+    return contains(name.data(), name.size());
   }
 
-  // Change the terminator character
-  auto terminator(char c) noexcept -> CsvParser && {
-    m_terminator = static_cast<Term>(c);
-    return std::move(*this);
+  // The column with this name. Throws std::out_of_range if there is none.
+  auto index(const char *name, const size_t size) const -> size_t {
+    const size_t column = find(name, size);
+    if (column == m_names.size()) {
+      throw std::out_of_range("Column \"" + std::string(name, size) +
+                              "\" is not in the header");
+    }
+    return column;
+  }
+  auto index(const std::string &name) const -> size_t {
+    return index(name.data(), name.size());
+  }
+  auto index(const char *name) const -> size_t {
+    return index(name, std::strlen(name));
   }
 
-  // The parser is in the empty state when there are
-  // no more tokens left to read from the input buffer
-  auto empty() -> bool { return m_state == State::EMPTY; }
+private:
+  std::vector<std::string> m_names;
+  // Column + 1 of the name hashed to each slot, 0 for a free slot
+  std::vector<size_t> m_slots;
 
-  // Not the actual position in the stream (its buffered) just the
-  // position up to last availiable token
-  auto position() const -> std::streamoff {
-    return m_scanposition + static_cast<std::streamoff>(m_cursor);
+  // FNV-1a
+  static auto hash(const char *data, const size_t size) -> size_t {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+      h = (h ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+    }
+    return static_cast<size_t>(h);
+  }
+
+  // The column of the name, or size() when it isn't in the header
+  auto find(const char *name, const size_t size) const -> size_t {
+    if (m_slots.empty()) {
+      return m_names.size();
+    }
+    const size_t mask = m_slots.size() - 1;
+    for (size_t slot = hash(name, size) & mask; m_slots[slot] != 0;
+         slot = (slot + 1) & mask) {
+      const std::string &candidate = m_names[m_slots[slot] - 1];
+      if (candidate.size() == size &&
+          std::equal(candidate.begin(), candidate.end(), name)) {
+        return m_slots[slot] - 1;
+      }
+    }
+    return m_names.size();
+  }
+};
+
+// A row together with the header that names its fields. It only points at
+// the two, so making one costs nothing. Asking for a name that isn't in the
+// header, or for a field past the end of a short row, throws
+// std::out_of_range.
+class NamedRow {
+public:
+  NamedRow(const Header &header, const std::vector<std::string> &fields)
+      : m_header(&header), m_fields(&fields) {}
+
+  auto operator[](const std::string &name) const -> const std::string & {
+    return (*this)[m_header->index(name)];
+  }
+  // Only arrays, so that a literal 0 isn't taken for a null name
+  template <size_t N>
+  auto operator[](const char (&name)[N]) const -> const std::string & {
+    return (*this)[m_header->index(name)];
+  }
+  // Columns are counted like in the header, so index() can be looked up
+  // once and used for every row. Literals like row[0] pick this one.
+  auto operator[](const size_t column) const -> const std::string & {
+    if (column >= m_fields->size()) {
+      throw std::out_of_range("Row has no field in column " +
+                              std::to_string(column));
+    }
+    return (*m_fields)[column];
+  }
+
+  auto size() const -> size_t { return m_fields->size(); }
+  auto header() const -> const Header & { return *m_header; }
+  auto fields() const -> const std::vector<std::string> & { return *m_fields; }
+
+private:
+  const Header *m_header;
+  const std::vector<std::string> *m_fields;
+};
+
+// CSV state for state machine
+enum class State {
+  START_OF_FIELD,
+  IN_FIELD,
+  IN_QUOTED_FIELD,
+  IN_ESCAPED_QUOTE,
+  END_OF_ROW,
+  EMPTY
+};
+
+// A position in the state machine between two bytes. after_cr is set when
+// the last byte was a '\r' terminator, whose '\n' (if any) is still ahead.
+struct ScanState {
+  ScanState() = default;
+  ScanState(State s, bool cr) : state(s), after_cr(cr) {}
+
+  auto operator==(const ScanState &other) const -> bool {
+    return state == other.state && after_cr == other.after_cr;
+  }
+
+  auto operator!=(const ScanState &other) const -> bool {
+    return !(*this == other);
+  }
+
+  State state = State::END_OF_ROW;
+  bool after_cr = false;
+};
+
+// Follows the parser's state machine without building any fields, which is
+// all that's needed to know where rows start. END_OF_ROW doubles as "at the
+// start of a row", which is also where a fresh parser begins.
+class RowScanner {
+public:
+  RowScanner(char quote, char delimiter, Term terminator)
+      : m_quote(quote), m_delimiter(delimiter), m_terminator(terminator) {
+    m_terminator_stops[0] =
+        terminator == Term::CRLF ? '\r' : static_cast<char>(terminator);
+    m_terminator_stops[1] =
+        terminator == Term::CRLF ? '\n' : static_cast<char>(terminator);
+    m_skip_delimiters = quote != delimiter &&
+                        quote != m_terminator_stops[0] &&
+                        quote != m_terminator_stops[1];
+  }
+
+  // Moves `state` over the bytes [first, last)
+  void scan(const char *data, const size_t first, const size_t last,
+            ScanState &state) const {
+    run(data, first, last, state, false);
+  }
+
+  // Moves `state` forward to the first row start at or after `first`.
+  // Returns its offset, or `last` if no row starts before it.
+  auto find_row_start(const char *data, const size_t first, const size_t last,
+                      ScanState &state) const -> size_t {
+    return run(data, first, last, state, true);
+  }
+
+  // Moves `state` over [first, last) and returns how many rows start there,
+  // counting the way the parser's iterator does: a row starts wherever there
+  // is a byte at the start of a row, so a final terminator doesn't add an
+  // empty row.
+  auto count_rows(const char *data, size_t first, const size_t last,
+                  ScanState &state) const -> uint64_t {
+    uint64_t rows = 0;
+    for (;;) {
+      first = run(data, first, last, state, true);
+      if (first == last) {
+        return rows;
+      }
+      rows++;
+      // Step into the row so the next search finds the one after it
+      run(data, first, first + 1, state, false);
+      first++;
+    }
+  }
+
+private:
+  char m_quote;
+  char m_delimiter;
+  Term m_terminator;
+  char m_terminator_stops[2];
+  // Whether unquoted fields can be crossed without stopping at delimiters
+  bool m_skip_delimiters = true;
+  detail::StopScanner m_scan_stops = detail::stop_scanner();
+
+  auto run(const char *data, size_t pos, const size_t last, ScanState &state,
+           const bool stop_at_row_start) const -> size_t {
+    while (pos < last) {
+      if (state.after_cr) {
+        state.after_cr = false;
+        if (data[pos] == '\n') {
+          pos++;
+          continue;
+        }
+      }
+      if (stop_at_row_start && state.state == State::END_OF_ROW) {
+        return pos;
+      }
+
+      char c = data[pos];
+      switch (state.state) {
+      case State::START_OF_FIELD:
+      case State::END_OF_ROW:
+        pos++;
+        if (c == m_terminator) {
+          end_row(c, state);
+        } else if (c == m_quote) {
+          state.state = State::IN_QUOTED_FIELD;
+        } else if (c == m_delimiter) {
+          state.state = State::START_OF_FIELD;
+        } else {
+          state.state = State::IN_FIELD;
+        }
+        break;
+
+      case State::IN_FIELD:
+        if (m_skip_delimiters) {
+          pos = skip_unquoted(data, pos, last, state);
+          break;
+        }
+        pos = static_cast<size_t>(
+            m_scan_stops(data + pos, data + last, m_delimiter,
+                         m_terminator_stops[0], m_terminator_stops[1]) -
+            data);
+        if (pos == last) {
+          break;
+        }
+        c = data[pos++];
+        if (c == m_terminator) {
+          end_row(c, state);
+        } else {
+          state.state = State::START_OF_FIELD;
+        }
+        break;
+
+      case State::IN_QUOTED_FIELD: {
+        const void *quote = std::memchr(data + pos, m_quote, last - pos);
+        if (quote == nullptr) {
+          pos = last;
+          break;
+        }
+        pos = static_cast<size_t>(static_cast<const char *>(quote) - data) + 1;
+        state.state = State::IN_ESCAPED_QUOTE;
+        break;
+      }
+
+      case State::IN_ESCAPED_QUOTE:
+        pos++;
+        if (c == m_terminator) {
+          end_row(c, state);
+        } else if (c == m_quote) {
+          state.state = State::IN_QUOTED_FIELD;
+        } else if (c == m_delimiter) {
+          state.state = State::START_OF_FIELD;
+        } else {
+          state.state = State::IN_FIELD;
+        }
+        break;
+
+      case State::EMPTY:
+        return last;
+      }
+    }
+
+    return last;
+  }
+
+  // Crosses unquoted fields up to the next terminator or opening quote.
+  // Delimiters don't change where rows start, so only quotes and terminators
+  // are searched for; a quote opens a quoted field only right after a
+  // delimiter; anywhere else in an unquoted field it is data.
+  auto skip_unquoted(const char *data, size_t pos, const size_t last,
+                     ScanState &state) const -> size_t {
+    const size_t entry = pos;
+    for (;;) {
+      pos = static_cast<size_t>(
+          m_scan_stops(data + pos, data + last, m_quote,
+                       m_terminator_stops[0], m_terminator_stops[1]) -
+          data);
+      if (pos == last) {
+        if (last > entry && data[last - 1] == m_delimiter) {
+          state.state = State::START_OF_FIELD;
+        }
+        return last;
+      }
+
+      const char c = data[pos++];
+      if (c != m_quote) {
+        end_row(c, state);
+        return pos;
+      }
+      if (pos - 1 > entry && data[pos - 2] == m_delimiter) {
+        state.state = State::IN_QUOTED_FIELD;
+        return pos;
+      }
+    }
+  }
+
+  void end_row(const char c, ScanState &state) const {
+    state.state = State::END_OF_ROW;
+    state.after_cr = m_terminator == Term::CRLF && c == '\r';
+  }
+};
+
+// Scans a chunk of the input before the state at its start is known, so
+// that chunks can be scanned in parallel. The chunk is scanned twice: once
+// assuming it starts outside quotes (IN_FIELD) and once assuming it starts
+// inside them (IN_QUOTED_FIELD). Once the previous chunk's end state is
+// known, resolve() follows the real state from the start of the chunk only
+// until it matches one of the two guesses, which is usually within a field
+// or two, and reuses that guess's end state.
+class ChunkSpeculation {
+public:
+  struct Resolution {
+    size_t row_start; // first row start in [begin, end), or end if none
+    ScanState end_state;
+  };
+
+  ChunkSpeculation() = default;
+
+  ChunkSpeculation(const RowScanner &scanner, const char *data,
+                   const size_t begin, const size_t end)
+      : m_scanner(&scanner), m_data(data), m_begin(begin), m_end(end) {
+    scanner.scan(data, begin, end, m_outside_end);
+    scanner.scan(data, begin, end, m_inside_end);
+  }
+
+  auto resolve(const ScanState &entry) const -> Resolution {
+    if (entry == outside()) {
+      return {row_start_from(m_begin, entry), m_outside_end};
+    }
+    if (entry == inside()) {
+      return {row_start_from(m_begin, entry), m_inside_end};
+    }
+
+    ScanState state = entry;
+    ScanState outside_guess = outside();
+    ScanState inside_guess = inside();
+    size_t row_start = m_end;
+    size_t pos = m_begin;
+    const size_t limit = m_end - m_begin > CONVERGENCE_LIMIT
+                             ? m_begin + CONVERGENCE_LIMIT
+                             : m_end;
+    for (; pos < limit; ++pos) {
+      if (row_start == m_end && is_row_start(state, pos)) {
+        row_start = pos;
+      }
+      if (state == outside_guess || state == inside_guess) {
+        const ScanState &end_state =
+            state == outside_guess ? m_outside_end : m_inside_end;
+        if (row_start == m_end) {
+          row_start = row_start_from(pos, state);
+        }
+        return {row_start, end_state};
+      }
+
+      m_scanner->scan(m_data, pos, pos + 1, state);
+      m_scanner->scan(m_data, pos, pos + 1, outside_guess);
+      m_scanner->scan(m_data, pos, pos + 1, inside_guess);
+    }
+
+    // No convergence: finish the chunk with the real state
+    if (row_start == m_end) {
+      row_start = m_scanner->find_row_start(m_data, pos, m_end, state);
+      pos = row_start;
+    }
+    m_scanner->scan(m_data, pos, m_end, state);
+    return {row_start, state};
+  }
+
+private:
+  static constexpr size_t CONVERGENCE_LIMIT = 64 * 1024;
+
+  const RowScanner *m_scanner = nullptr;
+  const char *m_data = nullptr;
+  size_t m_begin = 0;
+  size_t m_end = 0;
+  ScanState m_outside_end = outside();
+  ScanState m_inside_end = inside();
+
+  static auto outside() -> ScanState {
+    return ScanState(State::IN_FIELD, false);
+  }
+
+  static auto inside() -> ScanState {
+    return ScanState(State::IN_QUOTED_FIELD, false);
+  }
+
+  // A pending '\r' only ends its row after the '\n' that may follow it
+  auto is_row_start(const ScanState &state, const size_t pos) const -> bool {
+    return state.state == State::END_OF_ROW &&
+           (!state.after_cr || m_data[pos] != '\n');
+  }
+
+  auto row_start_from(const size_t pos, ScanState state) const -> size_t {
+    return m_scanner->find_row_start(m_data, pos, m_end, state);
+  }
+};
+
+// A batch of rows stored column by column, Arrow style. Each column keeps
+// its fields back to back in one character arena, with an offsets array so
+// that field i is chars[offsets[i], offsets[i + 1]), and a validity bitmap
+// (bit i of byte i / 8) that is cleared for empty fields. Rows shorter than
+// the widest row in the batch are padded with empty fields.
+class ColumnBatch {
+public:
+  struct Column {
+    std::vector<char> chars;
+    std::vector<size_t> offsets{0};
+    std::vector<uint8_t> validity;
+
+    auto size() const -> size_t { return offsets.size() - 1; }
+
+    auto is_valid(size_t row) const -> bool {
+      return ((validity[row / 8] >> (row % 8)) & 1U) != 0;
+    }
+
+    auto view(size_t row) const -> FieldView {
+      return FieldView(chars.data() + offsets[row],
+                       offsets[row + 1] - offsets[row]);
+    }
+
+    auto str(size_t row) const -> std::string { return view(row).str(); }
+
+  private:
+    friend class ColumnBatch;
+
+    void append(const char *data, const size_t size) {
+      const size_t row = this->size();
+      if (row % 8 == 0) {
+        validity.push_back(0);
+      }
+      if (size != 0) {
+        chars.insert(chars.end(), data, data + size);
+        validity.back() |= static_cast<uint8_t>(1U << (row % 8));
+      }
+      offsets.push_back(chars.size());
+    }
+
+    void clear() {
+      chars.clear();
+      offsets.resize(1);
+      validity.clear();
+    }
+
+    // Removes the last field
+    void pop() {
+      offsets.pop_back();
+      chars.resize(offsets.back());
+      const size_t row = size();
+      if (row % 8 == 0) {
+        validity.pop_back();
+      } else {
+        validity.back() &= static_cast<uint8_t>(~(1U << (row % 8)));
+      }
+    }
+  };
+
+  auto rows() const -> size_t { return m_rows; }
+  auto columns() const -> size_t { return m_columns.size(); }
+  auto column(size_t index) const -> const Column & {
+    return m_columns[index];
+  }
+
+  // Empties the batch but keeps every buffer's capacity, so refilling a
+  // batch of similar size doesn't allocate
+  void clear() {
+    for (auto &column : m_columns) {
+      column.clear();
+    }
+    while (!m_columns.empty()) {
+      m_spare.push_back(std::move(m_columns.back()));
+      m_columns.pop_back();
+    }
+    m_rows = 0;
+    m_row_fields = 0;
+    m_row_columns = 0;
+  }
+
+  // Adds a field to the row being built
+  void append(const char *data, const size_t size) {
+    if (m_row_fields == m_columns.size()) {
+      add_column();
+    }
+    m_columns[m_row_fields++].append(data, size);
+  }
+
+  void end_row() {
+    for (; m_row_fields < m_columns.size(); ++m_row_fields) {
+      m_columns[m_row_fields].append(nullptr, 0);
+    }
+    m_rows++;
+    m_row_fields = 0;
+    m_row_columns = m_columns.size();
+  }
+
+  auto row_in_progress() const -> bool { return m_row_fields != 0; }
+
+  // Takes back the fields of the row being built, and any column it added
+  void drop_row() {
+    for (size_t index = 0; index < m_row_fields; ++index) {
+      m_columns[index].pop();
+    }
+    while (m_columns.size() > m_row_columns) {
+      m_columns.back().clear();
+      m_spare.push_back(std::move(m_columns.back()));
+      m_columns.pop_back();
+    }
+    m_row_fields = 0;
+  }
+
+private:
+  std::vector<Column> m_columns;
+  // Columns dropped by clear(), kept for their capacity
+  std::vector<Column> m_spare;
+  size_t m_rows = 0;
+  size_t m_row_fields = 0;
+  // Columns there were before the row being built
+  size_t m_row_columns = 0;
+
+  // A column that first shows up part way through the batch is padded for
+  // the rows before it
+  void add_column() {
+    if (m_spare.empty()) {
+      m_columns.emplace_back();
+    } else {
+      m_columns.push_back(std::move(m_spare.back()));
+      m_spare.pop_back();
+    }
+    for (size_t row = 0; row < m_rows; ++row) {
+      m_columns.back().append(nullptr, 0);
+    }
+  }
+};
+
+// A row whose fields are stored back to back in one buffer, an arena that
+// is reset rather than freed between rows. Once it has grown to fit the
+// longest row, reading more rows doesn't allocate at all. The arena and the
+// field offsets come from Allocator.
+template <typename Allocator = std::allocator<char>> class BasicArenaRow {
+  using OffsetAllocator = typename std::allocator_traits<
+      Allocator>::template rebind_alloc<size_t>;
+
+public:
+  explicit BasicArenaRow(const Allocator &allocator = Allocator())
+      : m_arena(allocator), m_ends(OffsetAllocator(allocator)) {}
+
+  auto size() const -> size_t { return m_ends.size(); }
+  auto empty() const -> bool { return m_ends.empty(); }
+
+  // Views are invalidated by the next append() or clear()
+  auto operator[](size_t index) const -> FieldView {
+    const size_t begin = index == 0 ? 0 : m_ends[index - 1];
+    return FieldView(m_arena.data() + begin, m_ends[index] - begin);
+  }
+
+  void clear() {
+    m_arena.clear();
+    m_ends.clear();
+  }
+
+  void append(const char *data, const size_t size) {
+    m_arena.insert(m_arena.end(), data, data + size);
+    m_ends.push_back(m_arena.size());
+  }
+
+private:
+  std::vector<char, Allocator> m_arena;
+  std::vector<size_t, OffsetAllocator> m_ends;
+};
+
+using ArenaRow = BasicArenaRow<>;
+
+// The fields of one row as views, as ParallelReader::for_each_row() hands
+// them out. They point into the input, or into the reader's copies of fields
+// that had to be unescaped, and are only valid during the callback.
+class RowView {
+public:
+  RowView(const FieldView *fields, size_t size)
+      : m_fields(fields), m_size(size) {}
+
+  auto size() const -> size_t { return m_size; }
+  auto empty() const -> bool { return m_size == 0; }
+  auto operator[](size_t index) const -> const FieldView & {
+    return m_fields[index];
+  }
+  auto begin() const -> const FieldView * { return m_fields; }
+  auto end() const -> const FieldView * { return m_fields + m_size; }
+
+private:
+  const FieldView *m_fields;
+  size_t m_size;
+};
+
+#if defined(ARIA_CSV_HAS_COROUTINES)
+// The rows of generate_rows() and PushParser::rows(), produced lazily by a
+// coroutine that suspends after each one. T is a reference; the value it
+// refers to is only valid until the generator is resumed.
+template <typename T> class Generator {
+public:
+  using value_type = typename std::remove_reference<T>::type;
+
+  struct promise_type {
+    value_type *value = nullptr;
+    std::exception_ptr error;
+
+    auto get_return_object() -> Generator {
+      return Generator(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+    auto final_suspend() noexcept -> std::suspend_always { return {}; }
+    auto yield_value(value_type &yielded) noexcept -> std::suspend_always {
+      value = std::addressof(yielded);
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Generator::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type *;
+    using reference = T;
+
+    iterator() = default;
+    explicit iterator(std::coroutine_handle<promise_type> handle)
+        : m_handle(handle) {
+      resume();
+    }
+
+    auto operator*() const -> reference { return *m_handle.promise().value; }
+    auto operator->() const -> pointer { return m_handle.promise().value; }
+    auto operator++() -> iterator & {
+      resume();
+      return *this;
+    }
+    void operator++(int) { ++*this; }
+    auto operator==(const iterator &other) const -> bool {
+      return m_handle == other.m_handle;
+    }
+    auto operator!=(const iterator &other) const -> bool {
+      return !(*this == other);
+    }
+
+  private:
+    std::coroutine_handle<promise_type> m_handle;
+
+    void resume() {
+      m_handle.resume();
+      if (m_handle.done()) {
+        const std::exception_ptr error = m_handle.promise().error;
+        m_handle = nullptr;
+        if (error) {
+          std::rethrow_exception(error);
+        }
+      }
+    }
+  };
+
+  Generator(Generator &&other) noexcept
+      : m_handle(std::exchange(other.m_handle, nullptr)) {}
+  Generator(const Generator &) = delete;
+  auto operator=(const Generator &) -> Generator & = delete;
+  auto operator=(Generator &&) -> Generator & = delete;
+  ~Generator() {
+    if (m_handle) {
+      m_handle.destroy();
+    }
+  }
+
+  // A generator can be gone through once
+  auto begin() -> iterator {
+    return m_handle && !m_handle.done() ? iterator(m_handle) : iterator();
+  }
+  auto end() -> iterator { return iterator(); }
+
+private:
+  std::coroutine_handle<promise_type> m_handle;
+
+  explicit Generator(std::coroutine_handle<promise_type> handle)
+      : m_handle(handle) {}
+};
+#endif
+
+// Where a parser's bytes come from. read() copies up to `size` bytes into
+// `buffer` and returns how many it copied, which may be fewer than asked for
+// without meaning anything. Returning 0 ends the input.
+class Source {
+public:
+  virtual ~Source() = default;
+  virtual auto read(char *buffer, size_t size) -> size_t = 0;
+
+  // Skips up to `size` bytes and returns how many were skipped, which is
+  // fewer only at the end of the input. This reads them and drops them;
+  // sources that can seek override it.
+  virtual auto skip(uint64_t size) -> uint64_t {
+    char buffer[4096];
+    uint64_t skipped = 0;
+    while (skipped < size) {
+      const uint64_t left = size - skipped;
+      const size_t count =
+          read(buffer, left < sizeof(buffer) ? static_cast<size_t>(left)
+                                             : sizeof(buffer));
+      if (count == 0) {
+        break;
+      }
+      skipped += count;
+    }
+    return skipped;
+  }
+};
+
+// Reads from a std::istream through its streambuf, which skips the sentry
+// that istream::read() constructs on every call
+class IstreamSource : public Source {
+public:
+  explicit IstreamSource(std::istream &input) : m_input(&input) {
+    validate();
+  }
+
+  // Owns the stream, for parsers that outlive the scope that opened it
+  explicit IstreamSource(std::unique_ptr<std::istream> input)
+      : m_owned_input(std::move(input)), m_input(m_owned_input.get()) {
+    validate();
+  }
+
+  auto read(char *buffer, size_t size) -> size_t override {
+    const std::streamsize count = m_input->rdbuf()->sgetn(
+        buffer, static_cast<std::streamsize>(size));
+    if (count <= 0) {
+      m_input->setstate(std::ios::eofbit);
+      return 0;
+    }
+    return static_cast<size_t>(count);
+  }
+
+  // Seeks in streams that support it, like files and string streams
+  auto skip(uint64_t size) -> uint64_t override {
+    std::streambuf *buffer = m_input->rdbuf();
+    const std::streampos from = buffer->pubseekoff(0, std::ios::cur,
+                                                   std::ios::in);
+    const std::streampos end =
+        from == std::streampos(-1)
+            ? from
+            : buffer->pubseekoff(0, std::ios::end, std::ios::in);
+    if (end == std::streampos(-1)) {
+      return Source::skip(size);
+    }
+
+    const uint64_t left = static_cast<uint64_t>(end - from);
+    const uint64_t count = size < left ? size : left;
+    buffer->pubseekpos(from + static_cast<std::streamoff>(count),
+                       std::ios::in);
+    return count;
+  }
+
+private:
+  std::unique_ptr<std::istream> m_owned_input;
+  std::istream *m_input;
+
+  void validate() const {
+    if (m_input == nullptr) {
+      throw std::invalid_argument("Input stream is null");
+    }
+
+    if (!m_input->good() || m_input->rdbuf() == nullptr) {
+      throw std::runtime_error("Something is wrong with input stream");
+    }
+  }
+};
+
+// Copies out of a caller-owned buffer, which has to outlive the parser
+class MemorySource : public Source {
+public:
+  MemorySource(const char *data, size_t size) : m_data(data), m_size(size) {}
+
+  auto read(char *buffer, size_t size) -> size_t override {
+    const size_t count = size < m_size ? size : m_size;
+    std::memcpy(buffer, m_data, count);
+    m_data += count;
+    m_size -= count;
+    return count;
+  }
+
+  auto skip(uint64_t size) -> uint64_t override {
+    const size_t count = size < m_size ? static_cast<size_t>(size) : m_size;
+    m_data += count;
+    m_size -= count;
+    return count;
+  }
+
+private:
+  const char *m_data;
+  size_t m_size;
+};
+
+// Calls a function with the read() signature, e.g. to pull from a socket
+// or a decompressor without wrapping it in a stream
+class CallbackSource : public Source {
+public:
+  explicit CallbackSource(std::function<size_t(char *, size_t)> callback)
+      : m_callback(std::move(callback)) {}
+
+  auto read(char *buffer, size_t size) -> size_t override {
+    return m_callback(buffer, size);
+  }
+
+private:
+  std::function<size_t(char *, size_t)> m_callback;
+};
+
+#if defined(ARIA_CSV_HAS_FD)
+// Reads a file descriptor with read(2). The descriptor isn't closed.
+class FdSource : public Source {
+public:
+  explicit FdSource(int fd) : m_fd(fd) {}
+
+  auto read(char *buffer, size_t size) -> size_t override {
+    for (;;) {
+      const ssize_t count = ::read(m_fd, buffer, size);
+      if (count >= 0) {
+        return static_cast<size_t>(count);
+      }
+      if (errno != EINTR) {
+        throw std::runtime_error("Could not read input file descriptor");
+      }
+    }
+  }
+
+  // Seeks in regular files; pipes and sockets are read instead
+  auto skip(uint64_t size) -> uint64_t override {
+    const off_t from = ::lseek(m_fd, 0, SEEK_CUR);
+    const off_t end = from < 0 ? from : ::lseek(m_fd, 0, SEEK_END);
+    if (end < 0) {
+      return Source::skip(size);
+    }
+
+    const uint64_t left = end > from ? static_cast<uint64_t>(end - from) : 0;
+    const uint64_t count = size < left ? size : left;
+    if (::lseek(m_fd, from + static_cast<off_t>(count), SEEK_SET) < 0) {
+      throw std::runtime_error("Could not seek input file descriptor");
+    }
+    return count;
+  }
+
+private:
+  int m_fd;
+};
+#endif
+
+// Reads another source ahead of the parser on a background thread, into a
+// ring of buffers. While the parser scans one buffer the next ones are being
+// filled, so I/O latency overlaps with parsing instead of adding to it.
+// Errors from the wrapped source are rethrown by read() once the buffers
+// read before them have been consumed.
+class ReadAheadSource : public Source {
+public:
+  explicit ReadAheadSource(std::unique_ptr<Source> source,
+                           const size_t buffers = 4,
+                           const size_t buffer_size = 128 * 1024)
+      : m_source(std::move(source)), m_slots(buffers) {
+    if (m_source == nullptr) {
+      throw std::invalid_argument("Input source is null");
+    }
+    if (buffers == 0 || buffer_size == 0) {
+      throw std::invalid_argument("Read-ahead needs at least one buffer");
+    }
+    for (auto &slot : m_slots) {
+      slot.data.resize(buffer_size);
+    }
+    m_thread = std::thread([this]() { run(); });
+  }
+
+  ReadAheadSource(const ReadAheadSource &) = delete;
+  auto operator=(const ReadAheadSource &) -> ReadAheadSource & = delete;
+
+  // Waits for a read that is already under way in the wrapped source
+  ~ReadAheadSource() override {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_changed.notify_all();
+    m_thread.join();
+  }
+
+  auto read(char *buffer, size_t size) -> size_t override {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_changed.wait(lock, [this]() { return m_filled != 0 || m_done; });
+      if (m_filled == 0) {
+        if (m_error) {
+          std::rethrow_exception(m_error);
+        }
+        return 0;
+      }
+    }
+
+    // The slot is ours until it is handed back below
+    Slot &slot = m_slots[m_read_slot];
+    const size_t count =
+        size < slot.size - m_read_offset ? size : slot.size - m_read_offset;
+    std::memcpy(buffer, slot.data.data() + m_read_offset, count);
+    m_read_offset += count;
+    if (m_read_offset == slot.size) {
+      m_read_offset = 0;
+      m_read_slot = (m_read_slot + 1) % m_slots.size();
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_filled--;
+      }
+      m_changed.notify_all();
+    }
+    return count;
+  }
+
+private:
+  struct Slot {
+    std::vector<char> data;
+    size_t size = 0;
+  };
+
+  std::unique_ptr<Source> m_source;
+  std::vector<Slot> m_slots;
+  // Consumer side, only touched by read()
+  size_t m_read_slot = 0;
+  size_t m_read_offset = 0;
+  // Shared, guarded by m_mutex
+  std::mutex m_mutex;
+  std::condition_variable m_changed;
+  size_t m_filled = 0;
+  bool m_done = false;
+  bool m_stop = false;
+  std::exception_ptr m_error;
+  std::thread m_thread;
+
+  void run() {
+    for (size_t write_slot = 0;;
+         write_slot = (write_slot + 1) % m_slots.size()) {
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() {
+          return m_stop || m_filled < m_slots.size();
+        });
+        if (m_stop) {
+          return;
+        }
+      }
+
+      Slot &slot = m_slots[write_slot];
+      std::exception_ptr error;
+      try {
+        slot.size = m_source->read(slot.data.data(), slot.data.size());
+      } catch (...) {
+        slot.size = 0;
+        error = std::current_exception();
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (slot.size == 0) {
+          m_done = true;
+          m_error = error;
+        } else {
+          m_filled++;
+        }
+      }
+      m_changed.notify_all();
+      if (slot.size == 0) {
+        return;
+      }
+    }
+  }
+};
+
+#if defined(ARIA_CSV_WITH_ZLIB)
+// Inflates gzip or zlib data from another source straight into the buffer
+// read() is given. Concatenated gzip members are read as one stream, like
+// gunzip does.
+class GzipSource : public Source {
+public:
+  explicit GzipSource(std::unique_ptr<Source> source,
+                      const size_t input_size = 64 * 1024)
+      : m_source(std::move(source)), m_input(input_size) {
+    if (m_source == nullptr) {
+      throw std::invalid_argument("Input source is null");
+    }
+    std::memset(&m_stream, 0, sizeof(m_stream));
+    // 32 lets zlib detect a gzip or zlib header
+    if (inflateInit2(&m_stream, 15 + 32) != Z_OK) {
+      throw std::runtime_error("Could not start gzip decompression");
+    }
+  }
+
+  GzipSource(const GzipSource &) = delete;
+  auto operator=(const GzipSource &) -> GzipSource & = delete;
+
+  ~GzipSource() override { inflateEnd(&m_stream); }
+
+  auto read(char *buffer, size_t size) -> size_t override {
+    const uInt capacity =
+        size < UINT_MAX ? static_cast<uInt>(size) : UINT_MAX;
+    m_stream.next_out = reinterpret_cast<Bytef *>(buffer);
+    m_stream.avail_out = capacity;
+    while (m_stream.avail_out == capacity) {
+      // inflate() can hold back output when the last buffer filled up, so
+      // that is drained before reading more input
+      if (m_stream.avail_in == 0 && !m_flushing) {
+        const size_t count = m_source->read(m_input.data(), m_input.size());
+        if (count == 0) {
+          if (m_in_member) {
+            throw std::runtime_error("Truncated gzip input");
+          }
+          break;
+        }
+        m_stream.next_in = reinterpret_cast<Bytef *>(m_input.data());
+        m_stream.avail_in = static_cast<uInt>(count);
+      }
+
+      if (m_stream.avail_in != 0) {
+        m_in_member = true;
+      }
+      const int status = inflate(&m_stream, Z_NO_FLUSH);
+      if (status == Z_STREAM_END) {
+        m_in_member = false;
+        inflateReset(&m_stream);
+      } else if (status != Z_OK &&
+                 (status != Z_BUF_ERROR || m_stream.avail_in != 0)) {
+        throw std::runtime_error("Invalid gzip input");
+      }
+      m_flushing = status != Z_STREAM_END && m_stream.avail_out == 0;
+    }
+    return capacity - m_stream.avail_out;
+  }
+
+private:
+  std::unique_ptr<Source> m_source;
+  std::vector<char> m_input;
+  z_stream m_stream;
+  bool m_in_member = false;
+  bool m_flushing = false;
+};
+#endif
+
+#if defined(ARIA_CSV_WITH_ZSTD)
+// Decompresses zstd frames from another source straight into the buffer
+// read() is given. Concatenated frames are read as one stream.
+class ZstdSource : public Source {
+public:
+  explicit ZstdSource(std::unique_ptr<Source> source)
+      : m_source(std::move(source)), m_input(ZSTD_DStreamInSize()),
+        m_stream(ZSTD_createDStream()) {
+    if (m_source == nullptr) {
+      ZSTD_freeDStream(m_stream);
+      throw std::invalid_argument("Input source is null");
+    }
+    if (m_stream == nullptr || ZSTD_isError(ZSTD_initDStream(m_stream))) {
+      ZSTD_freeDStream(m_stream);
+      throw std::runtime_error("Could not start zstd decompression");
+    }
+    m_pending.src = m_input.data();
+  }
+
+  ZstdSource(const ZstdSource &) = delete;
+  auto operator=(const ZstdSource &) -> ZstdSource & = delete;
+
+  ~ZstdSource() override { ZSTD_freeDStream(m_stream); }
+
+  auto read(char *buffer, size_t size) -> size_t override {
+    ZSTD_outBuffer output = {buffer, size, 0};
+    while (output.pos == 0) {
+      // A full output buffer can still hold back data, so only read more
+      // input once zstd has taken all of the current input
+      if (m_pending.pos == m_pending.size && !m_flushing) {
+        const size_t count = m_source->read(m_input.data(), m_input.size());
+        if (count == 0) {
+          if (m_in_frame) {
+            throw std::runtime_error("Truncated zstd input");
+          }
+          break;
+        }
+        m_pending.size = count;
+        m_pending.pos = 0;
+      }
+
+      const size_t consumed = m_pending.pos;
+      const size_t hint = ZSTD_decompressStream(m_stream, &output, &m_pending);
+      if (ZSTD_isError(hint)) {
+        throw std::runtime_error("Invalid zstd input");
+      }
+      // Once a frame has ended, a call without input only asks for the next
+      // frame's header, which doesn't mean one has started
+      if (hint == 0) {
+        m_in_frame = false;
+      } else if (m_pending.pos != consumed) {
+        m_in_frame = true;
+      }
+      m_flushing = hint != 0 && output.pos == output.size;
+    }
+    return output.pos;
+  }
+
+private:
+  std::unique_ptr<Source> m_source;
+  std::vector<char> m_input;
+  ZSTD_DStream *m_stream;
+  ZSTD_inBuffer m_pending = {nullptr, 0, 0};
+  bool m_in_frame = false;
+  bool m_flushing = false;
+};
+#endif
+
+#if defined(ARIA_CSV_WITH_LZ4)
+// Decompresses lz4 frames (not raw lz4 blocks) from another source straight
+// into the buffer read() is given. Concatenated frames are read as one
+// stream.
+class Lz4Source : public Source {
+public:
+  explicit Lz4Source(std::unique_ptr<Source> source,
+                     const size_t input_size = 64 * 1024)
+      : m_source(std::move(source)), m_input(input_size) {
+    if (m_source == nullptr) {
+      throw std::invalid_argument("Input source is null");
+    }
+    if (LZ4F_isError(
+            LZ4F_createDecompressionContext(&m_context, LZ4F_VERSION))) {
+      throw std::runtime_error("Could not start lz4 decompression");
+    }
+  }
+
+  Lz4Source(const Lz4Source &) = delete;
+  auto operator=(const Lz4Source &) -> Lz4Source & = delete;
+
+  ~Lz4Source() override { LZ4F_freeDecompressionContext(m_context); }
+
+  auto read(char *buffer, size_t size) -> size_t override {
+    size_t produced = 0;
+    while (produced == 0) {
+      // Output held back when the last buffer filled up is drained first
+      if (m_pending == m_available && !m_flushing) {
+        const size_t count = m_source->read(m_input.data(), m_input.size());
+        if (count == 0) {
+          if (m_in_frame) {
+            throw std::runtime_error("Truncated lz4 input");
+          }
+          break;
+        }
+        m_pending = 0;
+        m_available = count;
+      }
+
+      size_t output_size = size;
+      size_t input_size = m_available - m_pending;
+      const size_t hint =
+          LZ4F_decompress(m_context, buffer, &output_size,
+                          m_input.data() + m_pending, &input_size, nullptr);
+      if (LZ4F_isError(hint)) {
+        throw std::runtime_error("Invalid lz4 input");
+      }
+      m_pending += input_size;
+      // Same as ZstdSource: only input can start a frame
+      if (hint == 0) {
+        m_in_frame = false;
+      } else if (input_size != 0) {
+        m_in_frame = true;
+      }
+      m_flushing = hint != 0 && output_size == size;
+      produced = output_size;
+    }
+    return produced;
+  }
+
+private:
+  std::unique_ptr<Source> m_source;
+  std::vector<char> m_input;
+  LZ4F_dctx *m_context = nullptr;
+  size_t m_pending = 0;
+  size_t m_available = 0;
+  bool m_in_frame = false;
+  bool m_flushing = false;
+};
+#endif
+
+namespace detail {
+// Hands out bytes that were read to sniff the format before reading on
+class PrefixedSource : public Source {
+public:
+  PrefixedSource(std::string prefix, std::unique_ptr<Source> source)
+      : m_prefix(std::move(prefix)), m_source(std::move(source)) {}
+
+  auto read(char *buffer, size_t size) -> size_t override {
+    if (m_offset == m_prefix.size()) {
+      return m_source->read(buffer, size);
+    }
+    const size_t left = m_prefix.size() - m_offset;
+    const size_t count = size < left ? size : left;
+    std::memcpy(buffer, m_prefix.data() + m_offset, count);
+    m_offset += count;
+    return count;
+  }
+
+private:
+  std::string m_prefix;
+  size_t m_offset = 0;
+  std::unique_ptr<Source> m_source;
+};
+} // namespace detail
+
+// Looks at the first bytes of a source, the way the parser looks for a
+// UTF-8 BOM, and wraps it in the matching decompressor if they are a gzip,
+// zstd or lz4 frame magic number. Anything else is passed through as is.
+// Compressed input whose codec wasn't enabled at build time throws.
+inline auto decompressing_source(std::unique_ptr<Source> source)
+    -> std::unique_ptr<Source> {
+  if (source == nullptr) {
+    throw std::invalid_argument("Input source is null");
+  }
+
+  char magic[4];
+  size_t size = 0;
+  while (size < sizeof(magic)) {
+    const size_t count = source->read(magic + size, sizeof(magic) - size);
+    if (count == 0) {
+      break;
+    }
+    size += count;
+  }
+  std::unique_ptr<Source> input(
+      new detail::PrefixedSource(std::string(magic, size), std::move(source)));
+
+  const auto starts_with = [&](const char *bytes, size_t length) {
+    return size >= length && std::memcmp(magic, bytes, length) == 0;
+  };
+  if (starts_with("\x1F\x8B", 2)) {
+#if defined(ARIA_CSV_WITH_ZLIB)
+    return std::unique_ptr<Source>(new GzipSource(std::move(input)));
+#else
+    throw std::runtime_error("gzip input needs ARIA_CSV_WITH_ZLIB");
+#endif
+  }
+  if (starts_with("\x28\xB5\x2F\xFD", 4)) {
+#if defined(ARIA_CSV_WITH_ZSTD)
+    return std::unique_ptr<Source>(new ZstdSource(std::move(input)));
+#else
+    throw std::runtime_error("zstd input needs ARIA_CSV_WITH_ZSTD");
+#endif
+  }
+  if (starts_with("\x04\x22\x4D\x18", 4)) {
+#if defined(ARIA_CSV_WITH_LZ4)
+    return std::unique_ptr<Source>(new Lz4Source(std::move(input)));
+#else
+    throw std::runtime_error("lz4 input needs ARIA_CSV_WITH_LZ4");
+#endif
+  }
+  return input;
+}
+
+// The dialect of CsvParser, which can be changed at runtime
+struct RuntimeDialect {
+  static constexpr bool fixed = false;
+
+  RuntimeDialect() = default;
+  RuntimeDialect(char q, char d, Term t)
+      : quote(q), delimiter(d), terminator(t) {}
+
+  char quote = '"';
+  char delimiter = ',';
+  Term terminator = Term::CRLF;
+};
+
+// A dialect known at compile time, e.g. FixedDialect<'\t'> for TSV or
+// FixedDialect<',', '"', static_cast<Term>('\n')> for '\n' only rows
+template <char Delimiter = ',', char Quote = '"', Term Terminator = Term::CRLF>
+struct FixedDialect {
+  static constexpr bool fixed = true;
+  static constexpr char quote = Quote;
+  static constexpr char delimiter = Delimiter;
+  static constexpr Term terminator = Terminator;
+};
+
+template <char Delimiter, char Quote, Term Terminator>
+constexpr char FixedDialect<Delimiter, Quote, Terminator>::quote;
+template <char Delimiter, char Quote, Term Terminator>
+constexpr char FixedDialect<Delimiter, Quote, Terminator>::delimiter;
+template <char Delimiter, char Quote, Term Terminator>
+constexpr Term FixedDialect<Delimiter, Quote, Terminator>::terminator;
+
+// Byte offsets of every stride-th row, so that a parser can start at a row
+// without parsing the ones before it. The index is built in one pass with
+// RowScanner, which follows quotes like the parser does while skipping
+// unquoted fields with the SIMD stop scanner and quoted ones with memchr,
+// and can be kept in a sidecar file next to the input between runs.
+class RowIndex {
+public:
+  // Row `row` starts at byte `offset`
+  struct Checkpoint {
+    uint64_t row;
+    uint64_t offset;
+  };
+
+  RowIndex() = default;
+
+  // Indexes [data, data + size). Row 0 starts after a UTF-8 BOM.
+  template <typename Dialect = RuntimeDialect>
+  static auto build(const char *data, const size_t size,
+                    const uint64_t stride = 1024,
+                    const Dialect &dialect = Dialect()) -> RowIndex {
+    Builder builder(stride, dialect);
+    builder.add(data, size);
+    return builder.finish();
+  }
+
+  // Indexes everything the source returns, 1 MiB at a time
+  template <typename Dialect = RuntimeDialect>
+  static auto build(Source &source, const uint64_t stride = 1024,
+                    const Dialect &dialect = Dialect()) -> RowIndex {
+    Builder builder(stride, dialect);
+    std::vector<char> buffer(1024 * 1024);
+    for (bool first = true;; first = false) {
+      size_t size = source.read(buffer.data(), buffer.size());
+      // Checking for a BOM needs the first three bytes together
+      while (first && size != 0 && size < 3) {
+        const size_t count =
+            source.read(buffer.data() + size, buffer.size() - size);
+        if (count == 0) {
+          break;
+        }
+        size += count;
+      }
+      if (size == 0) {
+        break;
+      }
+      builder.add(buffer.data(), size);
+    }
+    return builder.finish();
+  }
+
+  // Maps the file when it can be mapped, and reads it otherwise
+  template <typename Dialect = RuntimeDialect>
+  static auto build_file(const std::string &path,
+                         const uint64_t stride = 1024,
+                         const Dialect &dialect = Dialect()) -> RowIndex {
+#if defined(ARIA_CSV_HAS_MMAP)
+    if (detail::MappedFile::can_map(path)) {
+      const detail::MappedFile mapping(path);
+      return build(mapping.data(), mapping.size(), stride, dialect);
+    }
+#endif
+    std::ifstream file(path, std::ios::binary);
+    IstreamSource source(file);
+    return build(source, stride, dialect);
+  }
+
+  // Reads an index written by save()
+  static auto load(const std::string &path) -> RowIndex {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+      throw std::runtime_error("Could not open row index file");
+    }
+    const std::string bytes((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+
+    RowIndex index;
+    if (bytes.size() < HEADER || bytes.compare(0, 8, magic()) != 0 ||
+        get_u64(bytes, 8) != VERSION) {
+      throw std::runtime_error("Not a row index file");
+    }
+    index.m_stride = get_u64(bytes, 16);
+    index.m_rows = get_u64(bytes, 24);
+    index.m_bytes = get_u64(bytes, 32);
+    const uint64_t count = get_u64(bytes, 40);
+    if (index.m_stride == 0 ||
+        count != (index.m_rows + index.m_stride - 1) / index.m_stride ||
+        (bytes.size() - HEADER) / 8 != count ||
+        (bytes.size() - HEADER) % 8 != 0) {
+      throw std::runtime_error("Row index file is corrupt");
+    }
+
+    index.m_offsets.resize(static_cast<size_t>(count));
+    for (size_t i = 0; i < index.m_offsets.size(); ++i) {
+      index.m_offsets[i] = get_u64(bytes, HEADER + 8 * i);
+    }
+    return index;
+  }
+
+  // Writes the index as little-endian 64-bit words after a short header
+  void save(const std::string &path) const {
+    std::string bytes = magic();
+    put_u64(bytes, VERSION);
+    put_u64(bytes, m_stride);
+    put_u64(bytes, m_rows);
+    put_u64(bytes, m_bytes);
+    put_u64(bytes, m_offsets.size());
+    for (const uint64_t offset : m_offsets) {
+      put_u64(bytes, offset);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    if (!file) {
+      throw std::runtime_error("Could not write row index file");
+    }
+  }
+
+  auto rows() const -> uint64_t { return m_rows; }
+  auto stride() const -> uint64_t { return m_stride; }
+
+  // Size of the indexed input, to tell when a saved index is out of date
+  auto bytes() const -> uint64_t { return m_bytes; }
+
+  // The closest indexed row at or before `row`
+  auto checkpoint(const uint64_t row) const -> Checkpoint {
+    if (row >= m_rows) {
+      throw std::out_of_range("Row is past the end of the index");
+    }
+    const uint64_t slot = row / m_stride;
+    return {slot * m_stride, m_offsets[static_cast<size_t>(slot)]};
+  }
+
+private:
+  static constexpr size_t HEADER = 48;
+  static constexpr uint64_t VERSION = 1;
+
+  // Starts every index file, followed by VERSION
+  static auto magic() -> std::string { return "ARIACSVI"; }
+
+  uint64_t m_stride = 1;
+  uint64_t m_rows = 0;
+  uint64_t m_bytes = 0;
+  std::vector<uint64_t> m_offsets;
+
+  // Feeds consecutive buffers through one RowScanner, recording every
+  // stride-th row start
+  class Builder {
+  public:
+    template <typename Dialect>
+    Builder(const uint64_t stride, const Dialect &dialect)
+        : m_scanner(dialect.quote, dialect.delimiter, dialect.terminator),
+          m_stride(stride) {
+      if (stride == 0) {
+        throw std::invalid_argument("Row index stride must be positive");
+      }
+    }
+
+    void add(const char *data, const size_t size) {
+      size_t pos = 0;
+      if (m_bytes == 0 && size >= 3 && data[0] == '\xEF' &&
+          data[1] == '\xBB' && data[2] == '\xBF') {
+        pos = 3;
+      }
+      for (;;) {
+        pos = m_scanner.find_row_start(data, pos, size, m_state);
+        if (pos == size) {
+          break;
+        }
+        if (m_rows % m_stride == 0) {
+          m_offsets.push_back(m_bytes + pos);
+        }
+        m_rows++;
+        // Step into the row so the next search finds the one after it
+        m_scanner.scan(data, pos, pos + 1, m_state);
+        pos++;
+      }
+      m_bytes += size;
+    }
+
+    auto finish() -> RowIndex {
+      RowIndex index;
+      index.m_stride = m_stride;
+      index.m_rows = m_rows;
+      index.m_bytes = m_bytes;
+      index.m_offsets = std::move(m_offsets);
+      return index;
+    }
+
+  private:
+    RowScanner m_scanner;
+    ScanState m_state;
+    uint64_t m_stride;
+    uint64_t m_rows = 0;
+    uint64_t m_bytes = 0;
+    std::vector<uint64_t> m_offsets;
+  };
+
+  static void put_u64(std::string &bytes, const uint64_t value) {
+    for (int shift = 0; shift < 64; shift += 8) {
+      bytes.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+  }
+
+  static auto get_u64(const std::string &bytes, const uint64_t at)
+      -> uint64_t {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+      value = (value << 8) |
+              static_cast<unsigned char>(bytes[static_cast<size_t>(at) + i]);
+    }
+    return value;
+  }
+};
+
+class ParallelReader;
+template <typename Dialect> class BasicPushParser;
+
+// Reads and parses lines from a csv file. The dialect is either
+// RuntimeDialect, configured through quote(), delimiter() and terminator(),
+// or a FixedDialect whose characters are constants the compiler can fold
+// into every comparison.
+template <typename Dialect> class BasicCsvParser {
+  friend class ParallelReader;
+  friend class BasicPushParser<Dialect>;
+
+private:
+  State m_state = State::START_OF_FIELD;
+
+  // Configurable attributes
+  Dialect m_dialect{};
+  std::unique_ptr<Source> m_owned_source;
+  Source *m_source = nullptr;
+
+  // Default buffer capacities
+  static constexpr int FIELDBUF_CAP = 1024;
+  static constexpr int INPUTBUF_CAP = 1024 * 128;
+
+  // Bytes read from the source per refill. The input buffer is allocated at
+  // the first refill and sized between these, which are equal unless the
+  // size is adaptive.
+  size_t m_min_buffer = INPUTBUF_CAP;
+  size_t m_max_buffer = INPUTBUF_CAP;
+  // Refills in a row that interrupted only short fields
+  size_t m_short_refills = 0;
+
+  // Buffers
+  std::string m_fieldbuf{};
+  std::vector<char> m_inputbuf{};
+
+  // Bytes being parsed: the input buffer when reading from a stream, or
+  // the whole input when it is already in memory
+  const char *m_data = nullptr;
+  size_t m_memory_size = 0;
+#if defined(ARIA_CSV_HAS_MMAP)
+  std::unique_ptr<detail::MappedFile> m_mapping;
+#endif
+
+  // Misc
+  bool m_eof = false;
+  bool m_has_pending_empty_field = false;
+  bool m_skip_bom = true;
+  size_t m_cursor = 0;
+  size_t m_bytes_read = 0;
+  size_t m_field_begin = 0;
+  size_t m_field_end = 0;
+  detail::StopScanner m_scan_stops = detail::stop_scanner();
+  // Bytes that end an unquoted field besides the delimiter
+  char m_terminator_stops[2] = {'\r', '\n'};
+  Engine m_engine = Engine::STATE_MACHINE;
+  detail::StructuralIndex m_index{};
+  std::streamoff m_scanposition = 0;
+  // Where start_at() asked the first refill to begin
+  uint64_t m_start = 0;
+  // Column projection: m_selected[i] is set for the columns advance()
+  // returns, and empty when every column is. m_column is the column of the
+  // next field, and m_skip is set while an unselected one is scanned.
+  std::vector<char> m_selected;
+  size_t m_first_selected = 0;
+  size_t m_column = 0;
+  bool m_skip = false;
+  // Row filters: m_filters[i] holds the predicates of column i, and
+  // m_rejected is set by the ROW_END of a row that failed one
+  std::vector<std::vector<Predicate>> m_filters;
+  bool m_rejected = false;
+  // The header row once read_header() has read it, and the names of just
+  // the columns the parser returns
+  bool m_has_header = false;
+  Header m_header;
+  Header m_row_header;
+  // Push mode, for BasicPushParser: the input is whatever chunk was fed
+  // last, and running out of it leaves the state where it is (m_starved)
+  // instead of ending the CSV. A '\r' at the end of a chunk leaves a '\n'
+  // at the start of the next one to skip.
+  bool m_push = false;
+  bool m_starved = false;
+  bool m_pending_lf = false;
+  // next_fields(): m_keep_buffer is set while the batch has views into the
+  // input buffer, so a refill reads into m_batchbuf instead and the two are
+  // swapped. m_batch_in_row is set while a row has fields but no ROW_END
+  // yet. Filtered batches are copied into m_batch_fields a whole row at a
+  // time, and a row that didn't fit is held in m_batch_row.
+  std::vector<char> m_batchbuf{};
+  bool m_keep_buffer = false;
+  bool m_batch_in_row = false;
+  ArenaRow m_batch_fields;
+  ArenaRow m_batch_row;
+  size_t m_batch_next = 0;
+  bool m_batch_held = false;
+
+public:
+  // Delete copy constructor and assignment
+  BasicCsvParser(const BasicCsvParser &) = delete;
+  auto operator=(const BasicCsvParser &) -> BasicCsvParser & = delete;
+
+  // Allow move operations
+  BasicCsvParser(BasicCsvParser &&) = default;
+  auto operator=(BasicCsvParser &&) -> BasicCsvParser & = default;
+
+  // Creates the CSV parser which by default, splits on commas,
+  // uses quotes to escape, and handles CSV files that end in either
+  // '\r', '\n', or '\r\n'.
+  explicit BasicCsvParser(std::istream &input)
+      : BasicCsvParser(
+            std::unique_ptr<Source>(new IstreamSource(input))) {}
+
+  // Creates a CSV parser that owns the input stream. This is useful when the
+  // parser must outlive the local scope where the stream was created.
+  explicit BasicCsvParser(std::unique_ptr<std::istream> input)
+      : BasicCsvParser(
+            std::unique_ptr<Source>(new IstreamSource(std::move(input)))) {}
+
+  // Reads from a borrowed source, which has to outlive the parser
+  explicit BasicCsvParser(Source &source) : m_source(&source) {
+    // Reserve space upfront to improve performance
+    m_fieldbuf.reserve(FIELDBUF_CAP);
+    set_terminator_stops();
+  }
+
+  // Reads from a source the parser owns
+  explicit BasicCsvParser(std::unique_ptr<Source> source)
+      : m_owned_source(std::move(source)), m_source(m_owned_source.get()) {
+    if (m_source == nullptr) {
+      throw std::invalid_argument("Input source is null");
+    }
+    m_fieldbuf.reserve(FIELDBUF_CAP);
+    set_terminator_stops();
+  }
+
+  // Parses a caller-owned buffer in place. It is treated as one input
+  // buffer that is already full, so nothing is copied or refilled and field
+  // views point into it. The buffer has to outlive the parser.
+  BasicCsvParser(const char *data, const size_t size)
+      : BasicCsvParser(data, size, Dialect(), true) {
+    if (data == nullptr && size != 0) {
+      throw std::invalid_argument("Input buffer is null");
+    }
+    m_fieldbuf.reserve(FIELDBUF_CAP);
+  }
+
+  static auto from_file(const std::string &path) -> BasicCsvParser {
+    std::unique_ptr<std::istream> input(new std::ifstream(path));
+    return BasicCsvParser(std::move(input));
+  }
+
+  // Maps the file into memory and parses the mapping in place, so there is
+  // no stream and no copy into the input buffer, and field views point
+  // straight into the file. Files that can't be mapped (pipes, or platforms
+  // without mmap) are read through from_file() instead.
+  static auto from_mapped_file(const std::string &path) -> BasicCsvParser {
+#if defined(ARIA_CSV_HAS_MMAP)
+    if (detail::MappedFile::can_map(path)) {
+      return BasicCsvParser(std::unique_ptr<detail::MappedFile>(
+          new detail::MappedFile(path)));
+    }
+#endif
+    return from_file(path);
+  }
+
+  // Opens a file that may be gzip, zstd or lz4 compressed, which is detected
+  // from its first bytes. Decompression runs on a read-ahead thread so it
+  // overlaps with parsing. Uncompressed files are read as they are.
+  static auto from_compressed_file(const std::string &path)
+      -> BasicCsvParser {
+    std::unique_ptr<std::istream> file(
+        new std::ifstream(path, std::ios::binary));
+    std::unique_ptr<Source> input(new IstreamSource(std::move(file)));
+    return BasicCsvParser(std::unique_ptr<Source>(
+        new ReadAheadSource(decompressing_source(std::move(input)))));
+  }
+
+private:
+#if defined(ARIA_CSV_HAS_MMAP)
+  explicit BasicCsvParser(std::unique_ptr<detail::MappedFile> mapping)
+      : m_data(mapping->data()), m_memory_size(mapping->size()),
+        m_mapping(std::move(mapping)) {
+    m_fieldbuf.reserve(FIELDBUF_CAP);
+    set_terminator_stops();
+  }
+#endif
+
+  // Parses [data, data + size) in place with the given dialect. Chunks of a
+  // split input other than the first can't start with a BOM.
+  BasicCsvParser(const char *data, const size_t size, const Dialect &dialect,
+                 const bool skip_bom)
+      : m_dialect(dialect), m_data(data), m_memory_size(size) {
+    m_skip_bom = skip_bom;
+    set_terminator_stops();
+  }
+
+  void set_terminator_stops() {
+    const Term terminator = m_dialect.terminator;
+    m_terminator_stops[0] =
+        terminator == Term::CRLF ? '\r' : static_cast<char>(terminator);
+    m_terminator_stops[1] =
+        terminator == Term::CRLF ? '\n' : static_cast<char>(terminator);
+  }
+
+  // Picks the input buffer size for the next refill. An adaptive buffer
+  // doubles while fields cut by refills are over a quarter of it, and halves
+  // after 16 refills in a row that only cut fields under a sixteenth of it.
+  void size_input_buffer(const size_t field_bytes) {
+    size_t size = m_inputbuf.empty() ? m_min_buffer : m_inputbuf.size();
+    if (m_min_buffer != m_max_buffer && !m_inputbuf.empty()) {
+      if (field_bytes > size / 4) {
+        while (field_bytes > size / 4 && size < m_max_buffer) {
+          size *= 2;
+        }
+        m_short_refills = 0;
+      } else if (field_bytes < size / 16) {
+        if (++m_short_refills == 16) {
+          size /= 2;
+          m_short_refills = 0;
+        }
+      } else {
+        m_short_refills = 0;
+      }
+      size = size < m_min_buffer   ? m_min_buffer
+             : size > m_max_buffer ? m_max_buffer
+                                   : size;
+    }
+
+    if (size != m_inputbuf.size()) {
+      const bool shrink = size < m_inputbuf.size();
+      m_inputbuf.resize(size);
+      if (shrink) {
+        m_inputbuf.shrink_to_fit();
+      }
+      m_data = m_inputbuf.data();
+    }
+  }
+
+public:
+  // Change the quote character
+  auto quote(char c) noexcept -> BasicCsvParser && {
+    static_assert(!Dialect::fixed, "The dialect is fixed at compile time");
+    m_dialect.quote = c;
+    return std::move(*this);
+  }
+
+  // The quote, delimiter and terminator in use, e.g. for a CsvWriter
+  auto dialect() const noexcept -> const Dialect & { return m_dialect; }
+
+  // Change the delimiter character
+  auto delimiter(char c) noexcept -> BasicCsvParser && {
+    static_assert(!Dialect::fixed, "The dialect is fixed at compile time");
+    m_dialect.delimiter = c;
+    return std::move(*this);
+  }
+
+  // Change the terminator character
+  auto terminator(char c) noexcept -> BasicCsvParser && {
+    static_assert(!Dialect::fixed, "The dialect is fixed at compile time");
+    m_dialect.terminator = static_cast<Term>(c);
+    set_terminator_stops();
+    return std::move(*this);
+  }
+
+  // Bytes to read from the source at a time, 128 KiB by default. Memory
+  // that is parsed in place is never read, so this doesn't apply to it.
+  auto buffer_size(const size_t size) -> BasicCsvParser && {
+    return adaptive_buffer_size(size, size);
+  }
+
+  // Lets the read size move between min and max as the input goes. It
+  // starts at min and grows while refills keep landing in long fields, which
+  // then have to be copied out of the buffer, and shrinks back once fields
+  // are short again. Parsers of short-field data stay at min.
+  auto adaptive_buffer_size(const size_t min, const size_t max)
+      -> BasicCsvParser && {
+    if (min < 16 || max < min) {
+      throw std::invalid_argument("Buffer sizes must be 16 <= min <= max");
+    }
+    m_min_buffer = min;
+    m_max_buffer = max;
+    return std::move(*this);
+  }
+
+  // Capacity reserved for fields that have to be unescaped or are split by
+  // a refill, 1 KiB by default
+  auto field_buffer_size(const size_t size) -> BasicCsvParser && {
+    m_fieldbuf.reserve(size);
+    return std::move(*this);
+  }
+
+  // Choose how fields are found. STRUCTURAL_INDEX first indexes every
+  // separator and quote in a window of the input and then jumps between
+  // them, falling back to the state machine wherever the index can't be
+  // trusted. Both engines produce the same fields.
+  auto engine(Engine e) noexcept -> BasicCsvParser && {
+    m_engine = e;
+    return std::move(*this);
+  }
+
+  // Only returns the fields of these columns, counted from 0, in the order
+  // they appear in a row. Other fields are scanned past without being
+  // copied anywhere, and once a row's last selected column has been read
+  // the rest of the row is skipped in one go. A row that has none of the
+  // columns still comes back, as an empty row. An empty list selects every
+  // column again.
+  auto select_columns(const std::vector<size_t> &columns)
+      -> BasicCsvParser && {
+    m_selected.clear();
+    for (const size_t column : columns) {
+      if (column >= m_selected.size()) {
+        m_selected.resize(column + 1, 0);
+      }
+      m_selected[column] = 1;
+    }
+    m_first_selected = 0;
+    while (m_first_selected < m_selected.size() &&
+           m_selected[m_first_selected] == 0) {
+      m_first_selected++;
+    }
+    update_row_header();
+    return std::move(*this);
+  }
+
+  auto select_columns(std::initializer_list<size_t> columns)
+      -> BasicCsvParser && {
+    return select_columns(std::vector<size_t>(columns));
+  }
+
+  // Selects the columns with these names in the header, which is read
+  // first if read_header() hasn't been
+  auto select_columns(const std::vector<std::string> &names)
+      -> BasicCsvParser && {
+    std::vector<size_t> columns;
+    for (const auto &name : names) {
+      columns.push_back(header_column(name));
+    }
+    return select_columns(columns);
+  }
+
+  // Drops the rows whose field in this column, counted from 0 like in
+  // select_columns(), fails the predicate, and rows too short to have one.
+  // The test runs as soon as the field is read and a failing row is skipped
+  // to its end without reading its other fields. Several predicates on a
+  // row all have to match. The column doesn't have to be selected.
+  //
+  // Rows are dropped by the iterator, next_row(), next_batch(), count_rows()
+  // and TypedReader. next_field_view() still returns a dropped row's fields
+  // up to the one that failed, followed by a ROW_END for which
+  // row_rejected() is true.
+  auto where(const size_t column, Predicate predicate) -> BasicCsvParser && {
+    if (column >= m_filters.size()) {
+      m_filters.resize(column + 1);
+    }
+    m_filters[column].push_back(std::move(predicate));
+    return std::move(*this);
+  }
+
+  // where() on the column with this name in the header, which is read first
+  // if read_header() hasn't been
+  auto where(const std::string &name, Predicate predicate)
+      -> BasicCsvParser && {
+    return where(header_column(name), std::move(predicate));
+  }
+
+  // Reads the next row, normally the first, as the header and doesn't
+  // return it. Projection and filters don't apply to it.
+  auto read_header() -> BasicCsvParser && {
+    if (m_has_header) {
+      throw std::logic_error("The header has already been read");
+    }
+    std::vector<std::string> names;
+    for (;;) {
+      const FieldType type = scan_field();
+      if (type != FieldType::DATA) {
+        break;
+      }
+      names.push_back(view_field().str());
+    }
+    m_header = Header(std::move(names));
+    m_has_header = true;
+    update_row_header();
+    return std::move(*this);
+  }
+
+  // The names of the columns the parser returns, in the order they come
+  // back: the whole header, or only the selected columns. Empty until
+  // read_header().
+  auto header() const noexcept -> const Header & { return m_row_header; }
+
+  // Whether the last ROW_END ended a row that where() drops
+  auto row_rejected() const noexcept -> bool { return m_rejected; }
+
+  // Starts parsing at a byte offset instead of at the beginning, e.g. one
+  // from a RowIndex or a position() taken at a row end. The offset has to be
+  // the start of a row: that is where a fresh parser's state is right, and
+  // anywhere else fields would be read from the middle of a row. Sources
+  // that can seek skip there without reading, and position() keeps counting
+  // from the beginning of the input.
+  auto start_at(const std::streamoff offset) -> BasicCsvParser && {
+    if (offset < 0) {
+      throw std::invalid_argument("Start offset must not be negative");
+    }
+    if (m_scanposition != 0 || m_bytes_read != 0 || m_eof) {
+      throw std::logic_error("start_at() has to come before parsing");
+    }
+    m_start = static_cast<uint64_t>(offset);
+    return std::move(*this);
+  }
+
+  // Starts parsing at a row, counted from 0 like the rows of the iterator.
+  // The parser jumps to the closest indexed row before it and skips the rest,
+  // so at most index.stride() - 1 rows are parsed to get there. The index has
+  // to come from the same input and dialect.
+  auto start_at_row(const RowIndex &index, const uint64_t row)
+      -> BasicCsvParser && {
+    const RowIndex::Checkpoint checkpoint = index.checkpoint(row);
+    start_at(static_cast<std::streamoff>(checkpoint.offset));
+    for (uint64_t current = checkpoint.row; current < row;) {
+      const FieldType type = next_field_view().type;
+      if (type == FieldType::CSV_END) {
+        break;
+      }
+      if (type == FieldType::ROW_END) {
+        current++;
+      }
+    }
+    return std::move(*this);
+  }
+
+  // Counts the rows left, the way iterating over them would, but without
+  // building any fields: the input is only run through a RowScanner, which
+  // follows quotes and CRLF like the state machine does. Works from the
+  // start or from a row boundary, i.e. after a ROW_END or after the field
+  // that ended a row, and leaves the parser empty.
+  auto count_rows() -> uint64_t {
+    if (empty()) {
+      return 0;
+    }
+    if (m_state != State::END_OF_ROW &&
+        (m_state != State::START_OF_FIELD || m_has_pending_empty_field)) {
+      throw std::logic_error("count_rows() has to start at a row boundary");
+    }
+    if (!m_filters.empty()) {
+      return count_filtered_rows();
+    }
+
+    const RowScanner scanner(m_dialect.quote, m_dialect.delimiter,
+                             m_dialect.terminator);
+    ScanState state;
+    uint64_t rows = 0;
+    for (;;) {
+      if (m_cursor == m_bytes_read) {
+        if (m_eof) {
+          break;
+        }
+        fill_buffer();
+        continue;
+      }
+      rows += scanner.count_rows(m_data, m_cursor, m_bytes_read, state);
+      m_cursor = m_bytes_read;
+    }
+    m_state = State::EMPTY;
+    return rows;
+  }
+
+  // The parser is in the empty state when there are
+  // no more tokens left to read from the input buffer
+  auto empty() -> bool { return m_state == State::EMPTY; }
+
+  // Not the actual position in the stream (its buffered) just the
+  // position up to last availiable token
+  auto position() const -> std::streamoff {
+    return m_scanposition + static_cast<std::streamoff>(m_cursor);
+  }
+
+  // Reads a single field from the CSV
+  auto next_field() -> Field {
+    const FieldType type = advance();
+    if (type != FieldType::DATA) {
+      return Field(type);
+    }
+
+    return take_field();
+  }
+
+  // Reads a single field without copying it out of the parser. The view
+  // points straight into the input buffer unless the field had to be
+  // unescaped or was split across a buffer refill, in which case it points
+  // into the field buffer. Either way it is only valid until the parser is
+  // advanced again.
+  auto next_field_view() -> FieldView {
+    const FieldType type = advance();
+    if (type != FieldType::DATA) {
+      return FieldView(type);
+    }
+
+    return view_field();
+  }
+
+  // Parses up to max_rows rows into the batch, replacing what it held, and
+  // returns how many rows were read. Zero means the CSV is finished.
+  auto next_batch(ColumnBatch &batch, const size_t max_rows) -> size_t {
+    batch.clear();
+    while (batch.rows() < max_rows) {
+      const FieldView field = next_field_view();
+      switch (field.type) {
+      case FieldType::DATA:
+        batch.append(field.data, field.size);
+        break;
+      case FieldType::ROW_END:
+        if (m_rejected) {
+          batch.drop_row();
+        } else {
+          batch.end_row();
+        }
+        break;
+      case FieldType::CSV_END:
+        if (batch.row_in_progress()) {
+          batch.end_row();
+        }
+        return batch.rows();
+      }
+    }
+    return batch.rows();
+  }
+
+  // Reads the next row into an arena row, replacing what it held. Returns
+  // false once there are no rows left.
+  template <typename Allocator>
+  auto next_row(BasicArenaRow<Allocator> &row) -> bool {
+    row.clear();
+    for (;;) {
+      const FieldView field = next_field_view();
+      switch (field.type) {
+      case FieldType::DATA:
+        row.append(field.data, field.size);
+        break;
+      case FieldType::ROW_END:
+        if (m_rejected) {
+          row.clear();
+          break;
+        }
+        return true;
+      case FieldType::CSV_END:
+        return !row.empty();
+      }
+    }
+  }
+
+  // Fills fields[] with the next fields, and a ROW_END after each row, and
+  // returns how many it filled. Zero means the CSV is finished. A batch
+  // stops when it is full, after a field that had to be unescaped or copied,
+  // or after the input buffer is refilled once. The views stay valid until
+  // the next call that advances the parser. Every row ends with a ROW_END,
+  // including a last row without a terminator, and may be split across
+  // batches. With where() filters set, only rows that passed are returned,
+  // copied into the parser, and only a row longer than a batch is split.
+  auto next_fields(FieldView *fields, const size_t capacity) -> size_t {
+    if (fields == nullptr || capacity == 0) {
+      throw std::invalid_argument("next_fields() needs room for a field");
+    }
+    if (!m_filters.empty()) {
+      return next_filtered_fields(fields, capacity);
+    }
+
+    // Views into an in-memory input stay valid however far the batch goes
+    const bool refills = m_source != nullptr;
+    bool in_row = m_batch_in_row;
+    size_t count = 0;
+    while (count < capacity) {
+      m_keep_buffer = refills && count != 0;
+      const FieldType type = advance();
+      const bool refilled = m_keep_buffer != (refills && count != 0);
+      m_keep_buffer = false;
+
+      if (type == FieldType::DATA) {
+        in_row = true;
+        if (m_fieldbuf.empty()) {
+          fields[count++] =
+              FieldView(m_data + m_field_begin, m_field_end - m_field_begin);
+        } else {
+          // The field buffer is reused by the next field
+          fields[count++] = view_field();
+          break;
+        }
+      } else if (type == FieldType::ROW_END) {
+        fields[count++] = FieldView(FieldType::ROW_END);
+        in_row = false;
+      } else {
+        if (in_row) {
+          fields[count++] = FieldView(FieldType::ROW_END);
+          in_row = false;
+        }
+        break;
+      }
+      if (refilled) {
+        break;
+      }
+    }
+    m_batch_in_row = in_row;
+    return count;
+  }
+
+  // Runs the rest of the input through a visitor, calling
+  // visitor.on_field(data, size) for every field and visitor.on_row_end()
+  // after every row. The loop is instantiated for the visitor, so its calls
+  // are inlined and nothing is returned or switched on per field. The data
+  // is only valid during on_field(). Rows dropped by where() are never
+  // visited: with filters set, each row is held back until it has passed.
+  template <typename Visitor> void parse(Visitor &&visitor) {
+    if (!m_filters.empty()) {
+      ArenaRow row;
+      while (next_row(row)) {
+        for (size_t i = 0; i < row.size(); ++i) {
+          const FieldView field = row[i];
+          visitor.on_field(field.data, field.size);
+        }
+        visitor.on_row_end();
+      }
+      return;
+    }
+
+    // The last row ends with CSV_END when the input has no final terminator
+    bool in_row = false;
+    for (;;) {
+      const FieldType type = advance();
+      if (type == FieldType::DATA) {
+        const FieldView field = view_field();
+        visitor.on_field(field.data, field.size);
+        in_row = true;
+      } else if (type == FieldType::ROW_END) {
+        visitor.on_row_end();
+        in_row = false;
+      } else {
+        if (in_row) {
+          visitor.on_row_end();
+        }
+        return;
+      }
+    }
+  }
+
+#if defined(ARIA_CSV_HAS_COROUTINES)
+  // The rows next_row() reads, from a coroutine. The row yielded is reused,
+  // so it is only valid until the generator moves on.
+  auto generate_rows() -> Generator<const ArenaRow &> {
+    ArenaRow row;
+    while (next_row(row)) {
+      co_yield row;
+    }
+  }
+#endif
+
+private:
+  // next_fields() over the rows next_row() lets through
+  auto next_filtered_fields(FieldView *fields, const size_t capacity)
+      -> size_t {
+    m_batch_fields.clear();
+    size_t count = 0;
+    for (;;) {
+      if (!m_batch_held) {
+        if (!next_row(m_batch_row)) {
+          break;
+        }
+        m_batch_next = 0;
+        m_batch_held = true;
+      }
+      // The row and its ROW_END, which wait for the next batch unless this
+      // one is empty
+      const size_t left = m_batch_row.size() - m_batch_next + 1;
+      if (count != 0 && left > capacity - count) {
+        break;
+      }
+      while (count < capacity && m_batch_next < m_batch_row.size()) {
+        const FieldView field = m_batch_row[m_batch_next++];
+        m_batch_fields.append(field.data, field.size);
+        fields[count++] = FieldView(FieldType::DATA);
+      }
+      if (count == capacity) {
+        break;
+      }
+      fields[count++] = FieldView(FieldType::ROW_END);
+      m_batch_held = false;
+    }
+
+    // The views can only point into the copies once they have all been made
+    size_t copied = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (fields[i].type == FieldType::DATA) {
+        fields[i] = m_batch_fields[copied++];
+      }
+    }
+    return count;
+  }
+
+  // scan_field() with the column projection and the row filters applied
+  auto advance() -> FieldType {
+    if (m_selected.empty() && m_filters.empty()) {
+      return scan_field();
+    }
+
+    m_rejected = false;
+    for (;;) {
+      if (!m_selected.empty() && m_column >= m_selected.size() &&
+          m_column >= m_filters.size() && m_state == State::START_OF_FIELD &&
+          m_column != 0) {
+        skip_rest_of_row();
+      }
+
+      const size_t column = m_column;
+      const bool returned = m_selected.empty() ||
+                            (column < m_selected.size() &&
+                             m_selected[column] != 0);
+      const bool filtered =
+          column < m_filters.size() && !m_filters[column].empty();
+      m_skip = !returned && !filtered;
+      const FieldType type = scan_field();
+      m_skip = false;
+      if (type == FieldType::DATA) {
+        m_column++;
+        if (filtered && !field_passes(column)) {
+          return reject_row();
+        }
+        if (returned) {
+          return type;
+        }
+        continue;
+      }
+
+      if (type == FieldType::ROW_END || m_column != 0) {
+        m_rejected = m_column < m_filters.size();
+      }
+      // The last row ended without a terminator before any of its selected
+      // columns, or is dropped, so it is ended here for it to come back as
+      // a row of its own
+      const bool unreturned_row =
+          type == FieldType::CSV_END && m_column != 0 &&
+          (m_column <= m_first_selected || m_rejected);
+      m_column = 0;
+      return unreturned_row ? FieldType::ROW_END : type;
+    }
+  }
+
+  auto field_passes(const size_t column) -> bool {
+    const FieldView field = view_field();
+    for (const auto &predicate : m_filters[column]) {
+      if (!predicate.matches(field.data, field.size)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Ends the current row early, after the field that failed a predicate
+  auto reject_row() -> FieldType {
+    if (m_state == State::START_OF_FIELD) {
+      skip_rest_of_row();
+    }
+    if (m_state == State::END_OF_ROW) {
+      m_state = State::START_OF_FIELD;
+    }
+    m_column = 0;
+    m_rejected = true;
+    return FieldType::ROW_END;
+  }
+
+  auto header_column(const std::string &name) -> size_t {
+    if (!m_has_header) {
+      read_header();
+    }
+    if (!m_header.contains(name)) {
+      throw std::invalid_argument("Column \"" + name +
+                                  "\" is not in the header");
+    }
+    return m_header.index(name);
+  }
+
+  void update_row_header() {
+    if (m_selected.empty()) {
+      m_row_header = m_header;
+      return;
+    }
+    std::vector<std::string> names;
+    for (size_t column = 0;
+         column < m_selected.size() && column < m_header.size(); ++column) {
+      if (m_selected[column] != 0) {
+        names.push_back(m_header.name(column));
+      }
+    }
+    m_row_header = Header(std::move(names));
+  }
+
+  // Moves past the rest of the current row, which has no selected columns
+  // left, with a RowScanner instead of field by field
+  void skip_rest_of_row() {
+    const RowScanner scanner(m_dialect.quote, m_dialect.delimiter,
+                             m_dialect.terminator);
+    ScanState state(State::START_OF_FIELD, false);
+    for (;;) {
+      if (m_cursor == m_bytes_read) {
+        if (m_eof) {
+          break;
+        }
+        fill_buffer();
+        continue;
+      }
+      m_cursor = scanner.find_row_start(m_data, m_cursor, m_bytes_read, state);
+      if (m_cursor != m_bytes_read) {
+        break;
+      }
+    }
+
+    m_has_pending_empty_field = false;
+    m_state = state.state == State::END_OF_ROW ? State::END_OF_ROW
+                                                : State::START_OF_FIELD;
+  }
+
+  // count_rows() for a parser with row filters, which have to see fields
+  auto count_filtered_rows() -> uint64_t {
+    uint64_t rows = 0;
+    for (bool any = false;;) {
+      switch (advance()) {
+      case FieldType::DATA:
+        any = true;
+        break;
+      case FieldType::ROW_END:
+        rows += m_rejected ? 0 : 1;
+        any = false;
+        break;
+      case FieldType::CSV_END:
+        return rows + (any ? 1 : 0);
+      }
+    }
+  }
+
+  // Runs the state machine until a full field, a row end, or the end of the
+  // CSV is found. The contents of a DATA field are left in the field buffer
+  // and the pending input buffer range.
+  auto scan_field() -> FieldType {
+    if (empty()) {
+      return FieldType::CSV_END;
+    }
+    // A field cut off by the end of a pushed chunk carries on where it was
+    if (m_starved) {
+      m_starved = false;
+    } else {
+      m_fieldbuf.clear();
+      m_field_begin = 0;
+      m_field_end = 0;
+    }
+
+    if (m_engine == Engine::STRUCTURAL_INDEX &&
+        m_state == State::START_OF_FIELD && next_indexed_field()) {
+      return FieldType::DATA;
+    }
+
+    // This loop runs until either the parser has
+    // read a full field or until there's no tokens left to read
+    for (;;) {
+      const char *maybe_token = top_token();
+
+      // If we're out of tokens to read return whatever's left in the
+      // field and row buffers. If there's nothing left, return null.
+      if (maybe_token == nullptr) {
+        return m_starved ? FieldType::CSV_END : finish_at_eof(m_state);
+      }
+
+      // Parsing the CSV is done using a finite state machine
+      char c = *maybe_token;
+      switch (m_state) {
+      case State::START_OF_FIELD:
+        m_cursor++;
+        if (c == m_dialect.terminator) {
+          handle_crlf(c);
+          if (m_has_pending_empty_field) {
+            m_state = State::END_OF_ROW;
+            m_has_pending_empty_field = false;
+            return FieldType::DATA;
+          }
+          m_has_pending_empty_field = false;
+          return FieldType::ROW_END;
+        }
+
+        if (c == m_dialect.quote) {
+          m_has_pending_empty_field = false;
+          m_state = State::IN_QUOTED_FIELD;
+        } else if (c == m_dialect.delimiter) {
+          m_has_pending_empty_field = true;
+          return FieldType::DATA;
+        } else {
+          m_has_pending_empty_field = false;
+          m_state = State::IN_FIELD;
+          append_unquoted_field_chars();
+        }
+
+        break;
+
+      case State::IN_FIELD:
+        m_cursor++;
+        if (c == m_dialect.terminator) {
+          handle_crlf(c);
+          m_state = State::END_OF_ROW;
+          m_has_pending_empty_field = false;
+          return FieldType::DATA;
+        }
+
+        if (c == m_dialect.delimiter) {
+          m_state = State::START_OF_FIELD;
+          m_has_pending_empty_field = true;
+          return FieldType::DATA;
+        }
+
+        append_unquoted_field_chars();
+        break;
+
+      case State::IN_QUOTED_FIELD:
+        m_cursor++;
+        if (c == m_dialect.quote) {
+          m_state = State::IN_ESCAPED_QUOTE;
+        } else {
+          append_quoted_field_chars();
+        }
+
+        break;
+
+      case State::IN_ESCAPED_QUOTE:
+        m_cursor++;
+        if (c == m_dialect.terminator) {
+          handle_crlf(c);
+          m_state = State::END_OF_ROW;
+          m_has_pending_empty_field = false;
+          return FieldType::DATA;
+        }
+
+        if (c == m_dialect.quote) {
+          m_state = State::IN_QUOTED_FIELD;
+          append_field_range(m_cursor - 1, m_cursor);
+        } else if (c == m_dialect.delimiter) {
+          m_state = State::START_OF_FIELD;
+          m_has_pending_empty_field = true;
+          return FieldType::DATA;
+        } else {
+          m_state = State::IN_FIELD;
+          m_has_pending_empty_field = false;
+          append_unquoted_field_chars();
+        }
+
+        break;
+
+      case State::END_OF_ROW:
+        m_state = State::START_OF_FIELD;
+        return FieldType::ROW_END;
+
+      case State::EMPTY:
+        throw std::logic_error("Parser is already empty");
+      }
+    }
+  }
+
+  // Stage two of the structural index engine. Reads a whole field that
+  // starts at the cursor by jumping to the next separator outside quotes.
+  // Returns false, without consuming anything, whenever the state machine
+  // has to handle the field instead: the field runs past the trusted part
+  // of the index, it is empty, or its terminator needs a refill to check
+  // for CRLF.
+  auto next_indexed_field() -> bool {
+    if (m_cursor >= m_bytes_read) {
+      return false;
+    }
+    if (!m_index.covers(m_cursor)) {
+      const size_t window = m_bytes_read - m_cursor;
+      m_index.build(m_data, m_cursor,
+                    m_cursor + (window < detail::StructuralIndex::WINDOW
+                                    ? window
+                                    : detail::StructuralIndex::WINDOW),
+                    m_dialect.quote, m_dialect.delimiter,
+                    m_terminator_stops[0], m_terminator_stops[1]);
+    }
+
+    const size_t start = m_cursor;
+    const size_t separator = m_index.next_separator(start);
+    if (separator == start || separator >= m_index.trusted_end) {
+      return false;
+    }
+
+    const char sep = m_data[separator];
+    size_t next = separator + 1;
+    if (sep == m_dialect.terminator && m_dialect.terminator == Term::CRLF &&
+        sep == '\r') {
+      if (next == m_bytes_read) {
+        return false;
+      }
+      if (m_data[next] == '\n') {
+        next++;
+      }
+    }
+
+    if (m_data[start] != m_dialect.quote) {
+      append_field_range(start, separator);
+    } else {
+      append_indexed_quoted_field(start + 1, separator);
+    }
+
+    m_cursor = next;
+    if (sep == m_dialect.terminator) {
+      m_state = State::END_OF_ROW;
+      m_has_pending_empty_field = false;
+    } else {
+      m_has_pending_empty_field = true;
+    }
+    return true;
+  }
+
+  // Unescapes a quoted field whose raw bytes, after the opening quote, are
+  // [begin, separator). Inside the trusted index the field is a run of
+  // quoted text with "" escapes, a closing quote, then plain bytes.
+  void append_indexed_quoted_field(size_t begin, const size_t separator) {
+    while (!m_skip) {
+      const size_t quote = m_index.next_quote(begin, separator);
+      if (quote > begin) {
+        append_field_range(begin, quote);
+      }
+      if (quote + 1 < separator && m_data[quote + 1] == m_dialect.quote) {
+        append_field_range(quote + 1, quote + 2);
+        begin = quote + 2;
+        continue;
+      }
+      if (quote + 1 < separator) {
+        append_field_range(quote + 1, separator);
+      }
+      return;
+    }
+  }
+
+  auto finish_at_eof(const State previous_state) -> FieldType {
+    m_state = State::EMPTY;
+    // An unquoted field has data even when it was skipped rather than kept
+    if (m_has_pending_empty_field || has_field_data() ||
+        previous_state == State::IN_FIELD ||
+        previous_state == State::IN_QUOTED_FIELD ||
+        previous_state == State::IN_ESCAPED_QUOTE) {
+      m_has_pending_empty_field = false;
+      return FieldType::DATA;
+    }
+
+    return FieldType::CSV_END;
+  }
+
+  // When the parser hits the end of a line it needs
+  // to check the special case of '\r\n' as a terminator.
+  // If it finds that the previous token was a '\r', and
+  // the next token will be a '\n', it skips the '\n'.
+  void handle_crlf(const char c) {
+    if (m_dialect.terminator != Term::CRLF || c != '\r') {
+      return;
+    }
+
+    const char *token = top_token();
+    if ((token != nullptr) && *token == '\n') {
+      m_cursor++;
+    } else if (m_starved) {
+      m_starved = false;
+      m_pending_lf = true;
+    }
+  }
+
+  // The first character of the field was already consumed by the state
+  // machine, so the range starts one behind the cursor.
+  // Most fields are short, so the byte right after the first one is checked
+  // before handing the rest of the buffer to the vectorized scanner.
+  void append_unquoted_field_chars() {
+    const size_t start = m_cursor - 1;
+    const char *first = m_data + m_cursor;
+    const char *last = m_data + m_bytes_read;
+    if (first != last && *first != m_dialect.delimiter &&
+        *first != m_terminator_stops[0] && *first != m_terminator_stops[1]) {
+      const char *stop = m_scan_stops(first + 1, last, m_dialect.delimiter,
+                                      m_terminator_stops[0],
+                                      m_terminator_stops[1]);
+      m_cursor = static_cast<size_t>(stop - m_data);
+    }
+
+    append_field_range(start, m_cursor);
+  }
+
+  // Only the quote ends a quoted run, and memchr is already vectorized
+  void append_quoted_field_chars() {
+    const size_t start = m_cursor - 1;
+    const void *quote = std::memchr(m_data + m_cursor, m_dialect.quote,
+                                    m_bytes_read - m_cursor);
+    m_cursor = quote == nullptr
+                   ? m_bytes_read
+                   : static_cast<size_t>(static_cast<const char *>(quote) -
+                                         m_data);
+
+    append_field_range(start, m_cursor);
+  }
+
+  // Fields are tracked as a range of the input buffer for as long as their
+  // bytes are contiguous there. A gap (a skipped quote) or a refill moves
+  // what has been seen so far into the field buffer.
+  void append_field_range(const size_t begin, const size_t end) {
+    // Skipped fields are scanned but never kept
+    if (m_skip) {
+      return;
+    }
+    if (m_field_begin == m_field_end) {
+      m_field_begin = begin;
+    } else if (m_field_end != begin) {
+      flush_field_range();
+      m_field_begin = begin;
+    }
+    m_field_end = end;
+  }
+
+  void flush_field_range() {
+    m_fieldbuf.append(m_data + m_field_begin, m_field_end - m_field_begin);
+    m_field_begin = 0;
+    m_field_end = 0;
+  }
+
+  auto has_field_data() const -> bool {
+    return !m_fieldbuf.empty() || m_field_begin != m_field_end;
+  }
+
+  auto take_field() -> Field {
+    if (m_fieldbuf.empty()) {
+      return Field(
+          std::string(m_data + m_field_begin, m_field_end - m_field_begin));
+    }
+
+    flush_field_range();
+    return Field(std::move(m_fieldbuf));
+  }
+
+  auto view_field() -> FieldView {
+    if (m_fieldbuf.empty()) {
+      return FieldView(m_data + m_field_begin, m_field_end - m_field_begin);
+    }
+
+    flush_field_range();
+    return FieldView(m_fieldbuf.data(), m_fieldbuf.size());
+  }
+
+  // Pulls the next token from the input buffer, but does not move
+  // the cursor forward. If the stream is empty and the input buffer
+  // is also empty return a nullptr.
+  auto top_token() -> const char * {
+    // Refill the input buffer if it's been fully read. A source can return
+    // less than a full buffer, or only a BOM, so this may take a few reads.
+    while (m_cursor == m_bytes_read) {
+      // Return null if there's nothing left to read
+      if (m_eof) {
+        return nullptr;
+      }
+      if (m_push) {
+        m_starved = true;
+        return nullptr;
+      }
+      fill_buffer();
+    }
+
+    return m_data + m_cursor;
+  }
+
+  void fill_buffer() {
+    // The pending field range is about to be overwritten
+    if (m_field_begin != m_field_end) {
+      flush_field_range();
+    }
+    m_index.clear();
+    m_scanposition += static_cast<std::streamoff>(m_bytes_read);
+
+    if (m_source != nullptr) {
+      if (m_start != 0) {
+        m_scanposition = static_cast<std::streamoff>(m_source->skip(m_start));
+        m_start = 0;
+      }
+      // The batch next_fields() is filling still points into this buffer
+      if (m_keep_buffer) {
+        m_keep_buffer = false;
+        m_inputbuf.swap(m_batchbuf);
+        m_inputbuf.resize(m_batchbuf.size());
+        m_data = m_inputbuf.data();
+      }
+      size_input_buffer(m_fieldbuf.size());
+      const size_t capacity = m_inputbuf.size();
+      m_bytes_read = m_source->read(m_inputbuf.data(), capacity);
+      // Checking for a BOM needs the first three bytes together
+      while (m_scanposition == 0 && m_bytes_read != 0 && m_bytes_read < 3) {
+        const size_t count = m_source->read(m_inputbuf.data() + m_bytes_read,
+                                            capacity - m_bytes_read);
+        if (count == 0) {
+          break;
+        }
+        m_bytes_read += count;
+      }
+      m_eof = m_bytes_read == 0;
+    } else {
+      // In-memory input is a single buffer that's already full
+      m_bytes_read = m_scanposition == 0 ? m_memory_size : 0;
+      m_eof = true;
+    }
+    m_cursor = 0;
+
+    if (m_start != 0) {
+      m_cursor = m_start < m_bytes_read ? static_cast<size_t>(m_start)
+                                        : m_bytes_read;
+      m_start = 0;
+    } else if (m_skip_bom && m_scanposition == 0 && m_bytes_read >= 3 &&
+        m_data[0] == '\xEF' && m_data[1] == '\xBB' && m_data[2] == '\xBF') {
+      m_cursor = 3;
+    }
+  }
+
+public:
+  // Iterator implementation for the CSV parser, which reads
+  // from the CSV row by row in the form of a vector of strings
+  class iterator {
+  public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::vector<std::string>;
+    using pointer = const std::vector<std::string> *;
+    using reference = const std::vector<std::string> &;
+    using iterator_category = std::input_iterator_tag;
+
+    explicit iterator(BasicCsvParser *p, bool end = false) : m_parser(p) {
+      static constexpr size_t DEFAULT_ROW_CAPACITY = 50;
+      if (!end) {
+        m_row.reserve(DEFAULT_ROW_CAPACITY);
+        m_current_row = 0;
+        next();
+      }
+    }
+
+    auto operator++() -> iterator & {
+      next();
+      return *this;
+    }
+
+    auto operator++(int) -> iterator {
+      iterator i = (*this);
+      ++(*this);
+      return i;
+    }
+
+    auto operator==(const iterator &other) const -> bool {
+      return m_current_row == other.m_current_row &&
+             m_row.size() == other.m_row.size();
+    }
+
+    auto operator!=(const iterator &other) const -> bool {
+      return !(*this == other);
+    }
+
+    auto operator*() const -> reference { return m_row; }
+
+    auto operator->() const -> pointer { return &m_row; }
+
+  private:
+    value_type m_row{};
+    BasicCsvParser *m_parser;
+    int m_current_row = -1;
+
+    void next() {
+      value_type::size_type num_fields = 0;
+      for (;;) {
+        // Copying into the row's existing strings reuses their capacity,
+        // where moving fields in would allocate a new string every field
+        const auto field = m_parser->next_field_view();
+        switch (field.type) {
+        case FieldType::CSV_END:
+          if (num_fields < m_row.size()) {
+            m_row.resize(num_fields);
+          }
+          m_current_row = -1;
+          return;
+        case FieldType::ROW_END:
+          if (m_parser->m_rejected) {
+            num_fields = 0;
+            break;
+          }
+          if (num_fields < m_row.size()) {
+            m_row.resize(num_fields);
+          }
+          m_current_row++;
+          return;
+        case FieldType::DATA:
+          if (num_fields < m_row.size()) {
+            m_row[num_fields].assign(field.data, field.size);
+          } else {
+            m_row.emplace_back(field.data, field.size);
+          }
+          num_fields++;
+        }
+      }
+    }
+  };
+
+  auto begin() -> iterator { return iterator(this); };
+  auto end() -> iterator { return iterator(this, true); };
+
+  // iterator with its rows named by header()
+  class named_iterator {
+  public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = NamedRow;
+    using pointer = void;
+    using reference = NamedRow;
+    using iterator_category = std::input_iterator_tag;
+
+    named_iterator(iterator rows, const Header &header)
+        : m_rows(std::move(rows)), m_header(&header) {}
+
+    auto operator++() -> named_iterator & {
+      ++m_rows;
+      return *this;
+    }
+
+    auto operator==(const named_iterator &other) const -> bool {
+      return m_rows == other.m_rows;
+    }
+
+    auto operator!=(const named_iterator &other) const -> bool {
+      return !(*this == other);
+    }
+
+    auto operator*() const -> reference { return NamedRow(*m_header, *m_rows); }
+
+  private:
+    iterator m_rows;
+    const Header *m_header;
+  };
+
+  struct NamedRows {
+    named_iterator first;
+    named_iterator last;
+
+    auto begin() const -> named_iterator { return first; }
+    auto end() const -> named_iterator { return last; }
+  };
+
+  // The rows as NamedRows. The header is read first if read_header() hasn't
+  // been.
+  auto named_rows() -> NamedRows {
+    if (!m_has_header) {
+      read_header();
+    }
+    return NamedRows{named_iterator(begin(), m_row_header),
+                     named_iterator(end(), m_row_header)};
+  }
+};
+
+using CsvParser = BasicCsvParser<RuntimeDialect>;
+
+// Parses input that arrives in pieces, e.g. from a socket in an event loop,
+// without a blocking stream or a thread. Each feed() runs the parser's state
+// machine over the chunk and calls fn(const FieldView &) for every DATA
+// field and ROW_END it completes; a field or a CRLF cut off by the end of
+// the chunk carries on in the next one. finish() ends the input like the
+// end of a stream does, so the calls match next_field_view() on the whole
+// input exactly, ending with CSV_END.
+//
+// Views point into the chunk, or into the parser for fields that span
+// chunks, and are only valid during the call. Chunks don't have to outlive
+// feed(). Column projection and row filters don't apply here.
+template <typename Dialect> class BasicPushParser {
+public:
+  BasicPushParser() : m_parser(nullptr, 0) {
+    m_parser.m_push = true;
+  }
+
+  auto quote(char c) noexcept -> BasicPushParser && {
+    std::move(m_parser).quote(c);
+    return std::move(*this);
+  }
+
+  auto delimiter(char c) noexcept -> BasicPushParser && {
+    std::move(m_parser).delimiter(c);
+    return std::move(*this);
+  }
+
+  auto terminator(char c) noexcept -> BasicPushParser && {
+    std::move(m_parser).terminator(c);
+    return std::move(*this);
+  }
+
+  auto dialect() const noexcept -> const Dialect & {
+    return m_parser.dialect();
+  }
+
+  template <typename Fn>
+  void feed(const char *data, const size_t size, Fn &&fn) {
+    add_input(data, size);
+    FieldView field(FieldType::CSV_END);
+    while (next_field(field)) {
+      fn(field);
+    }
+  }
+
+  // Ends the input: a last row without a terminator is completed, and fn
+  // gets CSV_END
+  template <typename Fn> void finish(Fn &&fn) {
+    end_input();
+    FieldView field(FieldType::CSV_END);
+    while (next_field(field)) {
+      fn(field);
+    }
+  }
+
+#if defined(ARIA_CSV_HAS_COROUTINES)
+  // feed() as a generator of the rows the chunk completes, for a coroutine
+  // that awaits its own reads and then goes through the rows:
+  //
+  //   size_t size = co_await socket.async_read_some(buffer, use_awaitable);
+  //   for (const ArenaRow &row : parser.rows(buffer.data(), size)) {...}
+  //
+  // The generator parses lazily, so the chunk has to stay valid, and the
+  // generator has to be run to the end, before the parser is fed again.
+  auto rows(const char *data, const size_t size)
+      -> Generator<const ArenaRow &> {
+    add_input(data, size);
+    return generate_rows();
+  }
+
+  // finish() as a generator of the rows left
+  auto finish_rows() -> Generator<const ArenaRow &> {
+    end_input();
+    return generate_rows();
+  }
+#endif
+
+  // Bytes fed so far that the parser has gone past
+  auto position() const -> std::streamoff { return m_parser.position(); }
+
+private:
+  struct Chunk {
+    const char *data;
+    size_t size;
+  };
+
+  BasicCsvParser<Dialect> m_parser;
+  // The first bytes, held back until a BOM can be told apart
+  std::string m_head;
+  // Input not handed to the parser yet: at most the held back bytes and
+  // the rest of the chunk they came from
+  Chunk m_chunks[2] = {};
+  size_t m_chunk_count = 0;
+  size_t m_next_chunk = 0;
+  bool m_in_chunk = false;
+  bool m_done = false;
+#if defined(ARIA_CSV_HAS_COROUTINES)
+  ArenaRow m_row;
+#endif
+
+  void add_input(const char *data, const size_t size) {
+    if (m_parser.m_eof) {
+      throw std::logic_error("feed() after finish()");
+    }
+    if (data == nullptr && size != 0) {
+      throw std::invalid_argument("Input buffer is null");
+    }
+    m_chunk_count = 0;
+    m_next_chunk = 0;
+    // A BOM can only be recognized with the first three bytes together
+    size_t used = 0;
+    if (m_head.size() < 3) {
+      used = std::min(size, 3 - m_head.size());
+      m_head.append(data, used);
+      if (m_head.size() < 3) {
+        return;
+      }
+      if (m_head != "\xEF\xBB\xBF") {
+        m_chunks[m_chunk_count++] = Chunk{m_head.data(), m_head.size()};
+      } else {
+        m_parser.m_scanposition = 3;
+      }
+    }
+    m_chunks[m_chunk_count++] = Chunk{data + used, size - used};
+  }
+
+  void end_input() {
+    if (m_parser.m_eof) {
+      throw std::logic_error("finish() was already called");
+    }
+    m_chunk_count = 0;
+    m_next_chunk = 0;
+    if (m_head.size() < 3) {
+      m_chunks[m_chunk_count++] = Chunk{m_head.data(), m_head.size()};
+    }
+    m_parser.m_eof = true;
+  }
+
+  // The next field of the input added, or false once it has all been
+  // parsed
+  auto next_field(FieldView &field) -> bool {
+    while (!m_done) {
+      if (!m_in_chunk && !start_chunk() && !m_parser.m_eof) {
+        return false;
+      }
+      const FieldType type = m_parser.scan_field();
+      if (m_parser.m_starved) {
+        // The chunk belongs to the caller, so a field it cuts off is copied
+        if (m_parser.m_field_begin != m_parser.m_field_end) {
+          m_parser.flush_field_range();
+        }
+        m_in_chunk = false;
+        continue;
+      }
+      m_done = type == FieldType::CSV_END;
+      field = type == FieldType::DATA ? m_parser.view_field() : FieldView(type);
+      return true;
+    }
+    return false;
+  }
+
+  // Points the parser at the next non-empty chunk
+  auto start_chunk() -> bool {
+    while (m_next_chunk < m_chunk_count) {
+      const Chunk chunk = m_chunks[m_next_chunk++];
+      if (chunk.size == 0) {
+        continue;
+      }
+      m_parser.m_scanposition +=
+          static_cast<std::streamoff>(m_parser.m_bytes_read);
+      m_parser.m_data = chunk.data;
+      m_parser.m_bytes_read = chunk.size;
+      m_parser.m_cursor = 0;
+      if (m_parser.m_pending_lf) {
+        m_parser.m_pending_lf = false;
+        if (chunk.data[0] == '\n') {
+          m_parser.m_cursor = 1;
+        }
+      }
+      m_in_chunk = true;
+      return true;
+    }
+    return false;
+  }
+
+#if defined(ARIA_CSV_HAS_COROUTINES)
+  // Rows are put together like the iterator does
+  auto generate_rows() -> Generator<const ArenaRow &> {
+    FieldView field(FieldType::CSV_END);
+    while (next_field(field)) {
+      if (field.type == FieldType::DATA) {
+        m_row.append(field.data, field.size);
+        continue;
+      }
+      if (field.type == FieldType::ROW_END || !m_row.empty()) {
+        co_yield m_row;
+      }
+      m_row.clear();
+    }
+  }
+#endif
+};
+
+using PushParser = BasicPushParser<RuntimeDialect>;
+
+// Column types for TypedReader. DATE values are days since 1970-01-01 and
+// TIMESTAMP values are UTC microseconds since the epoch.
+enum class ColumnType { STRING, INT64, DOUBLE, BOOL, DATE, TIMESTAMP };
+
+// A converted field. Only the member for the column's type is set; empty
+// fields are null for every type except STRING.
+struct TypedValue {
+  bool null = false;
+  int64_t integer = 0;
+  double real = 0.0;
+  bool boolean = false;
+  std::string text;
+};
+
+// Thrown when a field doesn't convert to its column's type, or a row doesn't
+// have one field per column
+class ConversionError : public std::runtime_error {
+public:
+  ConversionError(const std::string &what, size_t row, size_t column,
+                  std::streamoff position)
+      : std::runtime_error(what), m_row(row), m_column(column),
+        m_position(position) {}
+
+  // Zero based, counting every row read including skipped ones
+  auto row() const -> size_t { return m_row; }
+  auto column() const -> size_t { return m_column; }
+  // The parser's position() after the failing field
+  auto position() const -> std::streamoff { return m_position; }
+
+private:
+  size_t m_row;
+  size_t m_column;
+  std::streamoff m_position;
+};
+
+// Reads rows from a borrowed parser and converts every field to its column
+// type straight from the parser's buffer, without building strings for
+// anything but STRING columns. Empty lines, and rows the parser's where()
+// drops, are skipped.
+template <typename Dialect> class BasicTypedReader {
+public:
+  BasicTypedReader(BasicCsvParser<Dialect> &parser,
+                   std::vector<ColumnType> schema)
+      : m_parser(parser), m_schema(std::move(schema)) {}
+
+  // Skips a row without converting it, e.g. a header. Returns false at the
+  // end of the CSV.
+  auto skip_row() -> bool {
+    for (bool any = false;;) {
+      switch (m_parser.next_field_view().type) {
+      case FieldType::DATA:
+        any = true;
+        break;
+      case FieldType::ROW_END:
+        m_row++;
+        return true;
+      case FieldType::CSV_END:
+        m_row += any;
+        return any;
+      }
+    }
+  }
+
+  // Reads the next row into `row`, which is resized to the schema and can be
+  // reused across calls. Returns false at the end of the CSV.
+  auto next_row(std::vector<TypedValue> &row) -> bool {
+    row.resize(m_schema.size());
+    for (size_t column = 0;;) {
+      const FieldView field = m_parser.next_field_view();
+      if (field.type == FieldType::DATA) {
+        if (column == m_schema.size()) {
+          fail("Row has more fields than the schema", column);
+        }
+        convert(field, column, row[column]);
+        column++;
+        continue;
+      }
+      if (m_parser.row_rejected()) {
+        m_row++;
+        column = 0;
+        continue;
+      }
+      if (column == 0) {
+        if (field.type == FieldType::CSV_END) {
+          return false;
+        }
+        m_row++;
+        continue;
+      }
+      if (column != m_schema.size()) {
+        fail("Row has fewer fields than the schema", column);
+      }
+      m_row++;
+      return true;
+    }
+  }
+
+  // Rows read so far, including skipped and empty ones
+  auto rows() const -> size_t { return m_row; }
+
+private:
+  BasicCsvParser<Dialect> &m_parser;
+  std::vector<ColumnType> m_schema;
+  size_t m_row = 0;
+
+  void convert(const FieldView &field, size_t column, TypedValue &value) {
+    const ColumnType type = m_schema[column];
+    if (type == ColumnType::STRING) {
+      value.null = false;
+      value.text.assign(field.data, field.size);
+      return;
+    }
+    value.null = field.size == 0;
+    if (value.null) {
+      return;
+    }
+
+    const char *first = field.data;
+    const char *last = first + field.size;
+    bool ok = false;
+    const char *name = "";
+    switch (type) {
+    case ColumnType::INT64:
+      ok = detail::parse_int64(first, last, value.integer);
+      name = "int64";
+      break;
+    case ColumnType::DOUBLE:
+      ok = detail::parse_double(first, last, value.real);
+      name = "double";
+      break;
+    case ColumnType::BOOL:
+      ok = detail::parse_bool(first, last, value.boolean);
+      name = "bool";
+      break;
+    case ColumnType::DATE:
+      ok = detail::parse_date(first, last, value.integer);
+      name = "date";
+      break;
+    case ColumnType::TIMESTAMP:
+      ok = detail::parse_timestamp(first, last, value.integer);
+      name = "timestamp";
+      break;
+    case ColumnType::STRING:
+      break;
+    }
+    if (!ok) {
+      fail("Field \"" + field.str() + "\" is not a valid " + name, column);
+    }
+  }
+
+  [[noreturn]] void fail(const std::string &what, size_t column) {
+    throw ConversionError(what + " (row " + std::to_string(m_row) +
+                              ", column " + std::to_string(column) + ")",
+                          m_row, column, m_parser.position());
+  }
+};
+
+using TypedReader = BasicTypedReader<RuntimeDialect>;
+
+// Where a row came from in a parallel parse. Sorting rows by (chunk, row)
+// gives their order in the input.
+struct RowTag {
+  size_t chunk;
+  size_t row;
+};
+
+// Parses one in-memory input on several threads. The input is cut into
+// chunks at row starts, each chunk is parsed by its own CsvParser on a pool
+// of worker threads, and rows are handed to a callback either in input
+// order or as soon as they are parsed.
+class ParallelReader {
+public:
+  using Row = std::vector<std::string>;
+
+  // The caller keeps [data, data + size) alive while rows are read
+  ParallelReader(const char *data, size_t size) : m_data(data), m_size(size) {}
+
+#if defined(ARIA_CSV_HAS_MMAP)
+  static auto from_mapped_file(const std::string &path) -> ParallelReader {
+    std::shared_ptr<detail::MappedFile> mapping(new detail::MappedFile(path));
+    ParallelReader reader(mapping->data(), mapping->size());
+    reader.m_mapping = std::move(mapping);
+    return reader;
+  }
+#endif
+
+  // Number of worker threads, defaults to the hardware concurrency
+  auto threads(unsigned n) noexcept -> ParallelReader && {
+    m_threads = n == 0 ? 1 : n;
+    return std::move(*this);
+  }
+
+  // Target chunk size in bytes. Chunks are extended to the next row start.
+  auto chunk_size(size_t bytes) noexcept -> ParallelReader && {
+    m_chunk_size = bytes == 0 ? 1 : bytes;
+    return std::move(*this);
+  }
+
+  auto quote(char c) noexcept -> ParallelReader && {
+    m_quote = c;
+    return std::move(*this);
   }
 
-  // Reads a single field from the CSV
-  auto next_field() -> Field {
-    if (empty()) {
-      return Field(FieldType::CSV_END);
-    }
-    m_fieldbuf.clear();
+  auto delimiter(char c) noexcept -> ParallelReader && {
+    m_delimiter = c;
+    return std::move(*this);
+  }
 
-    // This loop runs until either the parser has
-    // read a full field or until there's no tokens left to read
-    for (;;) {
-      char *maybe_token = top_token();
+  auto terminator(char c) noexcept -> ParallelReader && {
+    m_terminator = static_cast<Term>(c);
+    return std::move(*this);
+  }
 
-      // If we're out of tokens to read return whatever's left in the
-      // field and row buffers. If there's nothing left, return null.
-      if (maybe_token == nullptr) {
-        return finish_at_eof(m_state);
-      }
+  // Calls fn(RowTag, const RowView &) for every row, in input order, on the
+  // calling thread. Fields are views into the input wherever they can be,
+  // and the rows of at most two chunks per thread are kept in memory.
+  template <typename Fn> void for_each_row(Fn fn) {
+    const std::vector<size_t> bounds = chunk_bounds();
+    const size_t chunks = bounds.size() - 1;
+    const size_t window = 2 * static_cast<size_t>(m_threads);
 
-      // Parsing the CSV is done using a finite state machine
-      char c = *maybe_token;
-      switch (m_state) {
-      case State::START_OF_FIELD:
-        m_cursor++;
-        if (c == m_terminator) {
-          handle_crlf(c);
-          if (m_has_pending_empty_field) {
-            m_state = State::END_OF_ROW;
-            m_has_pending_empty_field = false;
-            return Field(std::move(m_fieldbuf));
+    std::vector<ChunkRows> parsed(chunks);
+    std::vector<char> ready(chunks, 0);
+    // Delivered chunks' storage, reused so that parsing stops allocating
+    std::vector<ChunkRows> spare;
+    size_t next = 0;
+    size_t delivered = 0;
+    Pool pool;
+
+    auto worker = [&]() {
+      for (;;) {
+        size_t chunk = 0;
+        ChunkRows rows;
+        {
+          std::unique_lock<std::mutex> lock(pool.mutex);
+          pool.changed.wait(lock, [&]() {
+            return pool.stop || next >= chunks || next < delivered + window;
+          });
+          if (pool.stop || next >= chunks) {
+            return;
+          }
+          chunk = next++;
+          if (!spare.empty()) {
+            rows = std::move(spare.back());
+            spare.pop_back();
           }
-          m_has_pending_empty_field = false;
-          return Field(FieldType::ROW_END);
         }
 
-        if (c == m_quote) {
-          m_has_pending_empty_field = false;
-          m_state = State::IN_QUOTED_FIELD;
-        } else if (c == m_delimiter) {
-          m_has_pending_empty_field = true;
-          return Field(std::move(m_fieldbuf));
-        } else {
-          m_has_pending_empty_field = false;
-          m_state = State::IN_FIELD;
-          append_unquoted_field_chars(c);
+        if (!pool.attempt([&]() { read_chunk(bounds, chunk, rows); })) {
+          return;
         }
 
-        break;
-
-      case State::IN_FIELD:
-        m_cursor++;
-        if (c == m_terminator) {
-          handle_crlf(c);
-          m_state = State::END_OF_ROW;
-          m_has_pending_empty_field = false;
-          return Field(std::move(m_fieldbuf));
+        {
+          std::lock_guard<std::mutex> lock(pool.mutex);
+          parsed[chunk] = std::move(rows);
+          ready[chunk] = 1;
         }
+        pool.changed.notify_all();
+      }
+    };
 
-        if (c == m_delimiter) {
-          m_state = State::START_OF_FIELD;
-          m_has_pending_empty_field = true;
-          return Field(std::move(m_fieldbuf));
+    pool.start(m_threads, worker);
+    pool.attempt([&]() {
+      for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        ChunkRows rows;
+        {
+          std::unique_lock<std::mutex> lock(pool.mutex);
+          pool.changed.wait(lock,
+                            [&]() { return pool.stop || ready[chunk] != 0; });
+          if (ready[chunk] == 0) {
+            return;
+          }
+          rows = std::move(parsed[chunk]);
+          delivered = chunk + 1;
         }
+        pool.changed.notify_all();
 
-        append_unquoted_field_chars(c);
-        break;
-
-      case State::IN_QUOTED_FIELD:
-        m_cursor++;
-        if (c == m_quote) {
-          m_state = State::IN_ESCAPED_QUOTE;
-        } else {
-          append_quoted_field_chars(c);
+        size_t begin = 0;
+        for (size_t row = 0; row < rows.ends.size(); ++row) {
+          const size_t end = rows.ends[row];
+          fn(RowTag{chunk, row}, RowView(rows.fields.data() + begin,
+                                         end - begin));
+          begin = end;
         }
 
-        break;
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        spare.push_back(std::move(rows));
+      }
+    });
+    pool.finish();
+  }
 
-      case State::IN_ESCAPED_QUOTE:
-        m_cursor++;
-        if (c == m_terminator) {
-          handle_crlf(c);
-          m_state = State::END_OF_ROW;
-          m_has_pending_empty_field = false;
-          return Field(std::move(m_fieldbuf));
-        }
+  // Calls fn(RowTag, const Row &) for every row from the worker threads,
+  // as soon as it is parsed. fn must be safe to call concurrently.
+  template <typename Fn> void for_each_row_unordered(Fn fn) {
+    const std::vector<size_t> bounds = chunk_bounds();
+    const size_t chunks = bounds.size() - 1;
+    std::atomic<size_t> next(0);
+    Pool pool;
 
-        if (c == m_quote) {
-          m_state = State::IN_QUOTED_FIELD;
-          m_fieldbuf += c;
-        } else if (c == m_delimiter) {
-          m_state = State::START_OF_FIELD;
-          m_has_pending_empty_field = true;
-          return Field(std::move(m_fieldbuf));
-        } else {
-          m_state = State::IN_FIELD;
-          m_has_pending_empty_field = false;
-          append_unquoted_field_chars(c);
+    auto worker = [&]() {
+      for (size_t chunk = next++; chunk < chunks && !pool.stopped();
+           chunk = next++) {
+        if (!pool.attempt([&]() {
+              CsvParser parser = chunk_parser(bounds, chunk);
+              size_t row = 0;
+              for (const auto &fields : parser) {
+                fn(RowTag{chunk, row++}, fields);
+              }
+            })) {
+          return;
         }
+      }
+    };
 
-        break;
+    pool.start(m_threads, worker);
+    pool.finish();
+  }
 
-      case State::END_OF_ROW:
-        m_state = State::START_OF_FIELD;
-        return Field(FieldType::ROW_END);
+  // Counts rows like iterating over them would, without building fields.
+  // Each chunk is counted by a RowScanner on the worker threads; with one
+  // thread or one chunk the input is counted directly instead, since finding
+  // chunk bounds would scan it twice.
+  auto count_rows() const -> uint64_t {
+    const RowScanner scanner(m_quote, m_delimiter, m_terminator);
+    // The first chunk's parser would skip a BOM
+    const size_t first = m_size >= 3 && m_data[0] == '\xEF' &&
+                                 m_data[1] == '\xBB' && m_data[2] == '\xBF'
+                             ? 3
+                             : 0;
+    if (m_threads == 1 || m_size - first <= m_chunk_size) {
+      ScanState state;
+      return scanner.count_rows(m_data, first, m_size, state);
+    }
 
-      case State::EMPTY:
-        throw std::logic_error("Parser is already empty");
+    const std::vector<size_t> bounds = chunk_bounds();
+    const size_t chunks = bounds.size() - 1;
+
+    std::vector<uint64_t> counts(chunks, 0);
+    std::atomic<size_t> next(0);
+    Pool pool;
+    auto worker = [&]() {
+      for (size_t chunk = next++; chunk < chunks; chunk = next++) {
+        ScanState state;
+        counts[chunk] = scanner.count_rows(
+            m_data, chunk == 0 ? first : bounds[chunk], bounds[chunk + 1],
+            state);
       }
+    };
+    pool.start(m_threads, worker);
+    pool.finish();
+
+    uint64_t rows = 0;
+    for (const uint64_t count : counts) {
+      rows += count;
     }
+    return rows;
   }
 
-private:
-  void validate_input() const {
-    if (m_input == nullptr) {
-      throw std::invalid_argument("Input stream is null");
-    }
+  // Offsets where the chunks start, followed by the input size. Nominal
+  // chunks are scanned speculatively on the worker threads, then resolved
+  // in order to move each boundary to the next row start.
+  auto chunk_bounds() const -> std::vector<size_t> {
+    const RowScanner scanner(m_quote, m_delimiter, m_terminator);
 
-    if (!m_input->good()) {
-      throw std::runtime_error("Something is wrong with input stream");
+    // A BOM is skipped by the first chunk's parser, so it mustn't be read
+    // as the start of a field here either
+    const bool has_bom = m_size > 3 && m_data[0] == '\xEF' &&
+                         m_data[1] == '\xBB' && m_data[2] == '\xBF';
+    std::vector<size_t> nominal{has_bom ? size_t(3) : size_t(0)};
+    while (m_size - nominal.back() > m_chunk_size) {
+      nominal.push_back(nominal.back() + m_chunk_size);
     }
-  }
+    nominal.push_back(m_size);
 
-  auto finish_at_eof(const State previous_state) -> Field {
-    m_state = State::EMPTY;
-    if (m_has_pending_empty_field || !m_fieldbuf.empty() ||
-        previous_state == State::IN_QUOTED_FIELD ||
-        previous_state == State::IN_ESCAPED_QUOTE) {
-      m_has_pending_empty_field = false;
-      return Field(std::move(m_fieldbuf));
-    }
+    // The first chunk's start state is known, so it is scanned exactly
+    const size_t chunks = nominal.size() - 1;
+    std::vector<ChunkSpeculation> speculations(chunks);
+    ScanState first_end;
+    std::atomic<size_t> next(0);
+    Pool pool;
+    auto worker = [&]() {
+      for (size_t chunk = next++; chunk < chunks; chunk = next++) {
+        if (chunk == 0) {
+          scanner.scan(m_data, nominal[0], nominal[1], first_end);
+        } else {
+          speculations[chunk] = ChunkSpeculation(
+              scanner, m_data, nominal[chunk], nominal[chunk + 1]);
+        }
+      }
+    };
+    pool.start(m_threads, worker);
+    pool.finish();
 
-    return Field(FieldType::CSV_END);
+    std::vector<size_t> bounds{0};
+    ScanState state = first_end;
+    for (size_t chunk = 1; chunk < chunks; ++chunk) {
+      const auto resolved = speculations[chunk].resolve(state);
+      if (resolved.row_start < nominal[chunk + 1]) {
+        bounds.push_back(resolved.row_start);
+      }
+      state = resolved.end_state;
+    }
+    bounds.push_back(m_size);
+    return bounds;
   }
 
-  // When the parser hits the end of a line it needs
-  // to check the special case of '\r\n' as a terminator.
-  // If it finds that the previous token was a '\r', and
-  // the next token will be a '\n', it skips the '\n'.
-  void handle_crlf(const char c) {
-    if (m_terminator != Term::CRLF || c != '\r') {
-      return;
-    }
+private:
+  const char *m_data;
+  size_t m_size;
+#if defined(ARIA_CSV_HAS_MMAP)
+  std::shared_ptr<detail::MappedFile> m_mapping;
+#endif
+  unsigned m_threads = std::thread::hardware_concurrency() == 0
+                           ? 1
+                           : std::thread::hardware_concurrency();
+  size_t m_chunk_size = 8 * 1024 * 1024;
+  char m_quote = '"';
+  char m_delimiter = ',';
+  Term m_terminator = Term::CRLF;
 
-    char *token = top_token();
-    if ((token != nullptr) && *token == '\n') {
-      m_cursor++;
-    }
+  auto chunk_parser(const std::vector<size_t> &bounds,
+                    const size_t chunk) const -> CsvParser {
+    return CsvParser(m_data + bounds[chunk], bounds[chunk + 1] - bounds[chunk],
+                     RuntimeDialect(m_quote, m_delimiter, m_terminator),
+                     chunk == 0);
   }
 
-  void append_unquoted_field_chars(const char first) {
-    m_fieldbuf += first;
+  // The rows of a parsed chunk: every field as a view, and where each row
+  // ends in fields. Fields that aren't a range of the input are copied into
+  // copies, and copied holds their index and offset there.
+  struct ChunkRows {
+    std::vector<FieldView> fields;
+    std::vector<size_t> ends;
+    std::vector<char> copies;
+    std::vector<std::pair<size_t, size_t>> copied;
+  };
 
-    const size_t start = m_cursor;
-    while (m_cursor < m_bytes_read) {
-      const char c = m_inputbuf[m_cursor];
-      if (c == m_delimiter || c == m_terminator) {
+  void read_chunk(const std::vector<size_t> &bounds, const size_t chunk,
+                  ChunkRows &rows) const {
+    rows.fields.clear();
+    rows.ends.clear();
+    rows.copies.clear();
+    rows.copied.clear();
+    const char *const first = m_data + bounds[chunk];
+    const char *const last = m_data + bounds[chunk + 1];
+    const std::less_equal<const char *> before;
+
+    CsvParser parser = chunk_parser(bounds, chunk);
+    size_t row_begin = 0;
+    for (;;) {
+      const FieldView field = parser.next_field_view();
+      if (field.type == FieldType::DATA) {
+        if (before(first, field.data) &&
+            before(field.data + field.size, last)) {
+          rows.fields.push_back(field);
+        } else {
+          rows.copied.emplace_back(rows.fields.size(), rows.copies.size());
+          rows.copies.insert(rows.copies.end(), field.data,
+                             field.data + field.size);
+          rows.fields.push_back(FieldView(nullptr, field.size));
+        }
+        continue;
+      }
+      // Like the row iterator: a row per ROW_END, and a last row cut off by
+      // the end of the chunk
+      if (field.type == FieldType::ROW_END ||
+          rows.fields.size() != row_begin) {
+        rows.ends.push_back(rows.fields.size());
+        row_begin = rows.fields.size();
+      }
+      if (field.type == FieldType::CSV_END) {
         break;
       }
-      m_cursor++;
     }
 
-    m_fieldbuf.append(&m_inputbuf[start], m_cursor - start);
+    // The copies have stopped growing, so views can point into them now
+    for (const auto &entry : rows.copied) {
+      rows.fields[entry.first].data = rows.copies.data() + entry.second;
+    }
   }
 
-  void append_quoted_field_chars(const char first) {
-    m_fieldbuf += first;
+  // Worker threads plus the shared stop flag. The first exception thrown by
+  // a worker or the consumer stops everyone and is rethrown by finish().
+  struct Pool {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::thread> threads;
+    std::exception_ptr error;
+    bool stop = false;
 
-    const size_t start = m_cursor;
-    while (m_cursor < m_bytes_read && m_inputbuf[m_cursor] != m_quote) {
-      m_cursor++;
+    template <typename Worker> void start(unsigned count, Worker &worker) {
+      for (unsigned i = 0; i < count; ++i) {
+        threads.emplace_back(std::ref(worker));
+      }
     }
 
-    m_fieldbuf.append(&m_inputbuf[start], m_cursor - start);
-  }
+    template <typename Body> auto attempt(Body body) -> bool {
+      try {
+        body();
+        return true;
+      } catch (...) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error) {
+            error = std::current_exception();
+          }
+          stop = true;
+        }
+        changed.notify_all();
+        return false;
+      }
+    }
 
-  // Pulls the next token from the input buffer, but does not move
-  // the cursor forward. If the stream is empty and the input buffer
-  // is also empty return a nullptr.
-  auto top_token() -> char * {
-    // Return null if there's nothing left to read
-    if (m_eof && m_cursor == m_bytes_read) {
-      return nullptr;
+    auto stopped() -> bool {
+      std::lock_guard<std::mutex> lock(mutex);
+      return stop;
     }
 
-    // Refill the input buffer if it's been fully read
-    if (m_cursor == m_bytes_read) {
-      fill_buffer();
-      // Return null if there's nothing left to read
-      if (m_bytes_read == 0) {
-        return nullptr;
+    void finish() {
+      for (auto &thread : threads) {
+        thread.join();
+      }
+      if (error) {
+        std::rethrow_exception(error);
       }
     }
+  };
+};
+
+// Writes rows of CSV in the parser's dialect. Output is collected in a
+// buffer, 256 KiB by default, and handed to the stream or sink when it is
+// full, on flush() and on destruction. A field is only quoted when it has to
+// be: when it contains the delimiter, the quote or a terminator byte, which
+// is checked with the same SIMD scanner the parser uses, or when it is the
+// only field of its row and empty, which would otherwise read back as an
+// empty line. Other fields, such as views straight from a parser, are copied
+// byte for byte. Term::CRLF rows end in "\r\n".
+template <typename Dialect> class BasicCsvWriter {
+public:
+  // Receives each full buffer
+  using Sink = std::function<void(const char *, size_t)>;
+
+  explicit BasicCsvWriter(std::ostream &output)
+      : BasicCsvWriter(Sink([&output](const char *data, const size_t size) {
+          if (!output.write(data, static_cast<std::streamsize>(size))) {
+            throw std::runtime_error("Failed to write CSV output");
+          }
+        })) {}
 
-    return &m_inputbuf[m_cursor];
+  explicit BasicCsvWriter(Sink sink) : m_sink(std::move(sink)) {
+    if (!m_sink) {
+      throw std::invalid_argument("Output sink is empty");
+    }
+    m_buffer.resize(DEFAULT_BUFFER);
   }
 
-  void fill_buffer() {
-    m_scanposition += static_cast<std::streamoff>(m_bytes_read);
+  BasicCsvWriter(const BasicCsvWriter &) = delete;
+  auto operator=(const BasicCsvWriter &) -> BasicCsvWriter & = delete;
+  auto operator=(BasicCsvWriter &&) -> BasicCsvWriter & = delete;
 
-    m_input->read(m_inputbuf.data(), INPUTBUF_CAP);
-    m_bytes_read = static_cast<size_t>(m_input->gcount());
-    m_eof = m_input->eof();
-    m_cursor = 0;
+  // A moved-from writer has nothing left to flush
+  BasicCsvWriter(BasicCsvWriter &&other) noexcept
+      : m_dialect(other.m_dialect), m_sink(std::move(other.m_sink)),
+        m_buffer(std::move(other.m_buffer)), m_used(other.m_used),
+        m_row_fields(other.m_row_fields), m_last_empty(other.m_last_empty),
+        m_scan_stops(other.m_scan_stops) {
+    other.m_used = 0;
+  }
 
-    if (m_scanposition == 0 && m_bytes_read >= 3 && m_inputbuf[0] == '\xEF' &&
-        m_inputbuf[1] == '\xBB' && m_inputbuf[2] == '\xBF') {
-      if (m_bytes_read > 3) {
-        m_cursor = 3;
-      } else {
-        m_bytes_read = 0;
-      }
+  // Errors from the final flush can't be reported here; call flush() first
+  // to see them
+  ~BasicCsvWriter() {
+    try {
+      flush();
+    } catch (...) {
     }
   }
 
-public:
-  // Iterator implementation for the CSV parser, which reads
-  // from the CSV row by row in the form of a vector of strings
-  class iterator {
-  public:
-    using difference_type = std::ptrdiff_t;
-    using value_type = std::vector<std::string>;
-    using pointer = const std::vector<std::string> *;
-    using reference = const std::vector<std::string> &;
-    using iterator_category = std::input_iterator_tag;
+  auto quote(char c) noexcept -> BasicCsvWriter && {
+    static_assert(!Dialect::fixed, "The dialect is fixed at compile time");
+    m_dialect.quote = c;
+    return std::move(*this);
+  }
 
-    explicit iterator(CsvParser *p, bool end = false) : m_parser(p) {
-      static constexpr size_t DEFAULT_ROW_CAPACITY = 50;
-      if (!end) {
-        m_row.reserve(DEFAULT_ROW_CAPACITY);
-        m_current_row = 0;
-        next();
-      }
-    }
+  auto delimiter(char c) noexcept -> BasicCsvWriter && {
+    static_assert(!Dialect::fixed, "The dialect is fixed at compile time");
+    m_dialect.delimiter = c;
+    return std::move(*this);
+  }
 
-    auto operator++() -> iterator & {
-      next();
-      return *this;
+  auto terminator(char c) noexcept -> BasicCsvWriter && {
+    static_assert(!Dialect::fixed, "The dialect is fixed at compile time");
+    m_dialect.terminator = static_cast<Term>(c);
+    return std::move(*this);
+  }
+
+  // Writes in the dialect of a parser, e.g. parser.dialect()
+  auto dialect(const Dialect &dialect) -> BasicCsvWriter && {
+    m_dialect = dialect;
+    return std::move(*this);
+  }
+
+  // Bytes collected before the sink is called
+  auto buffer_size(const size_t size) -> BasicCsvWriter && {
+    if (size == 0) {
+      throw std::invalid_argument("Output buffer size must be positive");
     }
+    flush();
+    m_buffer.resize(size);
+    return std::move(*this);
+  }
 
-    auto operator++(int) -> iterator {
-      iterator i = (*this);
-      ++(*this);
-      return i;
+  // Adds a field to the current row
+  void write_field(const char *data, const size_t size) {
+    if (m_row_fields++ != 0) {
+      put(m_dialect.delimiter);
     }
+    if (needs_quotes(data, size)) {
+      write_quoted(data, size);
+    } else {
+      put(data, size);
+    }
+  }
 
-    auto operator==(const iterator &other) const -> bool {
-      return m_current_row == other.m_current_row &&
-             m_row.size() == other.m_row.size();
+  void write_field(const std::string &field) {
+    write_field(field.data(), field.size());
+  }
+
+  void write_field(const FieldView &field) {
+    write_field(field.data, field.size);
+  }
+
+  // Ends the current row. A row without fields is written as an empty line,
+  // which the parser reads back as a row without fields too.
+  void end_row() {
+    if (m_row_fields == 1 && m_last_empty) {
+      put(m_dialect.quote);
+      put(m_dialect.quote);
+    }
+    if (m_dialect.terminator == Term::CRLF) {
+      put("\r\n", 2);
+    } else {
+      put(static_cast<char>(m_dialect.terminator));
     }
+    m_row_fields = 0;
+  }
 
-    auto operator!=(const iterator &other) const -> bool {
-      return !(*this == other);
+  template <typename Row> void write_row(const Row &row) {
+    for (const auto &field : row) {
+      write_field(field);
     }
+    end_row();
+  }
 
-    auto operator*() const -> reference { return m_row; }
+  void write_row(std::initializer_list<std::string> row) {
+    write_row<std::initializer_list<std::string>>(row);
+  }
 
-    auto operator->() const -> pointer { return &m_row; }
+  // Hands everything written so far to the stream or sink
+  void flush() {
+    if (m_used != 0) {
+      const size_t used = m_used;
+      m_used = 0;
+      m_sink(m_buffer.data(), used);
+    }
+  }
 
-  private:
-    value_type m_row{};
-    CsvParser *m_parser;
-    int m_current_row = -1;
+private:
+  static constexpr size_t DEFAULT_BUFFER = 256 * 1024;
 
-    void next() {
-      value_type::size_type num_fields = 0;
-      for (;;) {
-        auto field = m_parser->next_field();
-        switch (field.type) {
-        case FieldType::CSV_END:
-          if (num_fields < m_row.size()) {
-            m_row.resize(num_fields);
-          }
-          m_current_row = -1;
-          return;
-        case FieldType::ROW_END:
-          if (num_fields < m_row.size()) {
-            m_row.resize(num_fields);
-          }
-          m_current_row++;
-          return;
-        case FieldType::DATA:
-          if (num_fields < m_row.size()) {
-            m_row[num_fields] = std::move(field.data);
-          } else {
-            m_row.push_back(std::move(field.data));
-          }
-          num_fields++;
+  Dialect m_dialect{};
+  Sink m_sink;
+  std::vector<char> m_buffer;
+  size_t m_used = 0;
+  size_t m_row_fields = 0;
+  // Whether the last field written was empty, and not quoted
+  bool m_last_empty = false;
+  detail::StopScanner m_scan_stops = detail::stop_scanner();
+
+  auto needs_quotes(const char *data, const size_t size) -> bool {
+    m_last_empty = size == 0;
+    if (size == 0) {
+      return false;
+    }
+    const char first_stop =
+        m_dialect.terminator == Term::CRLF
+            ? '\r'
+            : static_cast<char>(m_dialect.terminator);
+    const char second_stop =
+        m_dialect.terminator == Term::CRLF
+            ? '\n'
+            : static_cast<char>(m_dialect.terminator);
+    // Most fields are short enough that setting up the SIMD scan costs more
+    // than looking at each byte
+    if (size < 16) {
+      for (size_t i = 0; i < size; ++i) {
+        const char c = data[i];
+        if (c == m_dialect.delimiter || c == m_dialect.quote ||
+            c == first_stop || c == second_stop) {
+          return true;
         }
       }
+      return false;
     }
-  };
+    return m_scan_stops(data, data + size, m_dialect.delimiter, first_stop,
+                        second_stop) != data + size ||
+           std::memchr(data, m_dialect.quote, size) != nullptr;
+  }
 
-  auto begin() -> iterator { return iterator(this); };
-  auto end() -> iterator { return iterator(this, true); };
+  // Doubles every quote in the field
+  void write_quoted(const char *data, const size_t size) {
+    const char *const last = data + size;
+    put(m_dialect.quote);
+    for (;;) {
+      const auto *quote = static_cast<const char *>(
+          std::memchr(data, m_dialect.quote, static_cast<size_t>(last - data)));
+      if (quote == nullptr) {
+        put(data, static_cast<size_t>(last - data));
+        break;
+      }
+      put(data, static_cast<size_t>(quote + 1 - data));
+      put(m_dialect.quote);
+      data = quote + 1;
+    }
+    put(m_dialect.quote);
+  }
+
+  void put(const char c) {
+    if (m_used == m_buffer.size()) {
+      flush();
+    }
+    m_buffer[m_used++] = c;
+  }
+
+  // Data larger than the buffer goes to the sink without being copied
+  void put(const char *data, const size_t size) {
+    if (size == 0) {
+      return;
+    }
+    if (size > m_buffer.size() - m_used) {
+      flush();
+      if (size >= m_buffer.size()) {
+        m_sink(data, size);
+        return;
+      }
+    }
+    std::memcpy(m_buffer.data() + m_used, data, size);
+    m_used += size;
+  }
 };
+
+template <typename Dialect>
+constexpr size_t BasicCsvWriter<Dialect>::DEFAULT_BUFFER;
+
+using CsvWriter = BasicCsvWriter<RuntimeDialect>;
 } // namespace csv
 } // namespace aria
 #endif
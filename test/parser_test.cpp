@@ -1,12 +1,19 @@
 #include "../parser.hpp"
+#include <algorithm>
+#include <clocale>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <gtest/gtest.h>
+#include <iterator>
 #include <memory>
+#include <mutex>
 #include <sstream>
 
 using namespace aria::csv;
 
-auto read_all(CsvParser &p) -> CSV {
+template <typename Parser> auto read_all(Parser &p) -> CSV {
   CSV csv;
   for (const auto &row : p) {
     csv.push_back(row);
@@ -20,6 +27,38 @@ auto parse_string(const std::string &input) -> CSV {
   return read_all(parser);
 }
 
+// The files in TEST_DATA_DIR that use the default dialect
+const char *const kTestFiles[] = {
+    "comma_in_quotes.csv",     "empty.csv",      "emptyUnquoted.csv",
+    "empty_crlf.csv",          "escaped_quotes.csv",
+    "json.csv",                "newlines.csv",   "newlines_crlf.csv",
+    "quotes_and_newlines.csv", "simple.csv",     "simple_crlf.csv",
+    "utf8.csv",                "bom_simple.csv", "bom_empty.csv",
+    "empty_file.csv"};
+
+auto read_file(const std::string &path) -> std::string {
+  std::ifstream file(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+}
+
+auto read_rows(const std::string &path) -> CSV {
+  CsvParser parser = CsvParser::from_file(path);
+  return read_all(parser);
+}
+
+// Checks that read() gives what expected() gives, by default the rows of a
+// streamed parser, for every file in kTestFiles
+void expect_same_rows(
+    const std::function<CSV(const std::string &path)> &read,
+    const std::function<CSV(const std::string &path)> &expected = read_rows) {
+  for (const auto *name : kTestFiles) {
+    SCOPED_TRACE(name);
+    const std::string path = std::string(TEST_DATA_DIR "/") + name;
+    EXPECT_EQ(read(path), expected(path));
+  }
+}
+
 TEST(CsvParserTest, CommaInQuotes) {
   std::ifstream f(TEST_DATA_DIR "/comma_in_quotes.csv");
   CsvParser parser(f);
@@ -133,6 +172,32 @@ TEST(CsvParserTest, DifferentQuote) {
   EXPECT_EQ(read_all(parser), expected);
 }
 
+TEST(CsvParserTest, FixedDialects) {
+  std::ifstream delimiter_file(TEST_DATA_DIR "/delimiter.csv");
+  BasicCsvParser<FixedDialect<';'>> delimiter(delimiter_file);
+  CSV delimiter_expected = {{"a", "b", "c"}, {"1", "2", "3"}, {"4", "5", ","}};
+  EXPECT_EQ(read_all(delimiter), delimiter_expected);
+
+  std::ifstream terminator_file(TEST_DATA_DIR "/terminator.csv");
+  BasicCsvParser<FixedDialect<',', '"', static_cast<Term>(';')>> terminator(
+      terminator_file);
+  CSV terminator_expected = {
+      {"a", "b", "c"}, {"1", "2", "3"}, {"4", "5", "6\n"}};
+  EXPECT_EQ(read_all(terminator), terminator_expected);
+
+  std::ifstream quote_file(TEST_DATA_DIR "/quote.csv");
+  BasicCsvParser<FixedDialect<',', '\''>> quote(quote_file);
+  CSV quote_expected = {{"1, 2, 3", "4, 5, 6", "\n7\n8\n9"}};
+  EXPECT_EQ(read_all(quote), quote_expected);
+
+  std::istringstream stream("'a;b';c'd\n1;2;3");
+  auto indexed =
+      BasicCsvParser<FixedDialect<';', '\'', static_cast<Term>('\n')>>(stream)
+          .engine(Engine::STRUCTURAL_INDEX);
+  CSV indexed_expected = {{"a;b", "c'd"}, {"1", "2", "3"}};
+  EXPECT_EQ(read_all(indexed), indexed_expected);
+}
+
 TEST(CsvParserTest, BomSimple) {
   std::ifstream f(TEST_DATA_DIR "/bom_simple.csv");
   CsvParser parser(f);
@@ -223,3 +288,1668 @@ TEST(CsvParserTest, FromFileRejectsMissingFile) {
   EXPECT_THROW(CsvParser::from_file(TEST_DATA_DIR "/does_not_exist.csv"),
                std::runtime_error);
 }
+
+auto read_all_views(CsvParser &p) -> CSV {
+  CSV csv;
+  std::vector<std::string> row;
+  for (;;) {
+    const auto field = p.next_field_view();
+    switch (field.type) {
+    case FieldType::CSV_END:
+      if (!row.empty()) {
+        csv.push_back(row);
+      }
+      return csv;
+    case FieldType::ROW_END:
+      csv.push_back(row);
+      row.clear();
+      break;
+    case FieldType::DATA:
+      row.push_back(field.str());
+    }
+  }
+}
+
+TEST(CsvParserTest, FieldViewsMatchOwnedFields) {
+  expect_same_rows([](const std::string &path) {
+    std::ifstream file(path);
+    CsvParser viewed(file);
+    return read_all_views(viewed);
+  });
+}
+
+TEST(CsvParserTest, FieldViewUnescapesQuotes) {
+  std::istringstream stream("\"a\"\"b\",\"c\"d");
+  CsvParser parser(stream);
+
+  EXPECT_EQ(parser.next_field_view().str(), "a\"b");
+  EXPECT_EQ(parser.next_field_view().str(), "cd");
+  EXPECT_EQ(parser.next_field_view().type, FieldType::CSV_END);
+}
+
+TEST(CsvParserTest, FieldViewSurvivesBufferRefill) {
+  std::string input;
+  std::string expected_long(200 * 1024, 'x');
+  input += "a,";
+  input += expected_long;
+  input += ",\"";
+  input += expected_long;
+  input += "\"\r\nb\r\n";
+
+  std::istringstream stream(input);
+  CsvParser parser(stream);
+  CSV expected = {{"a", expected_long, expected_long}, {"b"}};
+  EXPECT_EQ(read_all_views(parser), expected);
+}
+
+TEST(CsvParserTest, FieldViewSurvivesRefillWhileCheckingCrlf) {
+  // The '\r' is the last byte of the first buffer, so looking for the '\n'
+  // refills the buffer after the field has been read.
+  const std::string field(128 * 1024 - 1, 'x');
+  std::istringstream stream(field + "\r\ny");
+  CsvParser parser(stream);
+  CSV expected = {{field}, {"y"}};
+  EXPECT_EQ(read_all_views(parser), expected);
+}
+
+TEST(CsvParserTest, StopScannersAgreeWithScalarScan) {
+  std::string input;
+  for (int i = 0; i < 300; ++i) {
+    input += static_cast<char>('a' + (i * 7) % 26);
+  }
+  const char *first = input.data();
+  const char *last = first + input.size();
+
+  for (const auto scanner : aria::csv::detail::available_stop_scanners()) {
+    for (size_t stop = 0; stop <= input.size(); stop += 13) {
+      std::string probe = input;
+      if (stop < probe.size()) {
+        probe[stop] = '\n';
+      }
+      const char *p = probe.data();
+      for (size_t begin = 0; begin < 70 && begin <= probe.size(); ++begin) {
+        EXPECT_EQ(scanner(p + begin, p + probe.size(), ',', '\r', '\n'),
+                  aria::csv::detail::scan_stops_scalar(
+                      p + begin, p + probe.size(), ',', '\r', '\n'));
+      }
+    }
+    EXPECT_EQ(scanner(first, last, ',', '\r', '\n'), last);
+  }
+}
+
+auto read_fields(CsvParser &p) -> std::vector<std::pair<FieldType, std::string>> {
+  std::vector<std::pair<FieldType, std::string>> fields;
+  for (;;) {
+    auto field = p.next_field();
+    fields.emplace_back(field.type, std::move(field.data));
+    if (field.type == FieldType::CSV_END) {
+      return fields;
+    }
+  }
+}
+
+// Deterministic mix of plain, quoted, escaped and malformed fields
+auto make_mixed_csv(size_t size) -> std::string {
+  static const char *pieces[] = {"abc",  ",",         "\n",     "\r\n",
+                                 "\r",   "\"q,\nq\"", "\"\"",   "\"a\"\"b\"",
+                                 "a\"b", "\"a\"b",    "\"\"\"", ",,"};
+  std::string out;
+  uint32_t state = 12345;
+  while (out.size() < size) {
+    state = state * 1103515245U + 12345U;
+    out += pieces[(state >> 16) % (sizeof(pieces) / sizeof(pieces[0]))];
+  }
+  return out;
+}
+
+TEST(CsvParserTest, StructuralIndexMatchesStateMachineOnTestData) {
+  for (const auto *name : kTestFiles) {
+    const std::string path = std::string(TEST_DATA_DIR "/") + name;
+    std::ifstream fsm_file(path);
+    CsvParser fsm(fsm_file);
+    std::ifstream indexed_file(path);
+    CsvParser indexed =
+        CsvParser(indexed_file).engine(Engine::STRUCTURAL_INDEX);
+    EXPECT_EQ(read_fields(indexed), read_fields(fsm)) << name;
+  }
+}
+
+TEST(CsvParserTest, StructuralIndexMatchesStateMachineAcrossRefills) {
+  const std::string input = make_mixed_csv(600 * 1024);
+
+  std::istringstream fsm_stream(input);
+  CsvParser fsm(fsm_stream);
+  std::istringstream indexed_stream(input);
+  CsvParser indexed =
+      CsvParser(indexed_stream).engine(Engine::STRUCTURAL_INDEX);
+  EXPECT_EQ(read_fields(indexed), read_fields(fsm));
+}
+
+TEST(CsvParserTest, StructuralIndexHonorsDialect) {
+  std::istringstream stream("'a;b';c'd\n1;2;3");
+  CsvParser parser = CsvParser(stream)
+                         .delimiter(';')
+                         .quote('\'')
+                         .terminator('\n')
+                         .engine(Engine::STRUCTURAL_INDEX);
+  CSV expected = {{"a;b", "c'd"}, {"1", "2", "3"}};
+  EXPECT_EQ(read_all(parser), expected);
+}
+
+TEST(CsvParserTest, MappedFileMatchesStreamedFile) {
+  expect_same_rows([](const std::string &path) {
+    CsvParser mapped = CsvParser::from_mapped_file(path);
+    return read_all_views(mapped);
+  });
+}
+
+TEST(CsvParserTest, MappedFileWorksWithStructuralIndex) {
+  CsvParser parser = CsvParser::from_mapped_file(TEST_DATA_DIR "/newlines.csv")
+                         .engine(Engine::STRUCTURAL_INDEX);
+  CSV expected = {{"a", "b", "c"},
+                  {"1", "2", "3"},
+                  {"Once upon \na time", "5", "6"},
+                  {"7", "8", "9"}};
+  EXPECT_EQ(read_all(parser), expected);
+}
+
+TEST(CsvParserTest, MappedFileRejectsMissingFile) {
+  EXPECT_THROW(CsvParser::from_mapped_file(TEST_DATA_DIR "/does_not_exist.csv"),
+               std::runtime_error);
+}
+
+auto parse_parallel(const std::string &input, size_t chunk_size) -> CSV {
+  CSV csv;
+  RowTag last{0, 0};
+  ParallelReader(input.data(), input.size())
+      .threads(4)
+      .chunk_size(chunk_size)
+      .for_each_row([&](const RowTag &tag, const RowView &row) {
+        if (!csv.empty()) {
+          EXPECT_TRUE(tag.chunk == last.chunk ? tag.row == last.row + 1
+                                              : tag.chunk > last.chunk &&
+                                                    tag.row == 0);
+        }
+        last = tag;
+        csv.emplace_back();
+        for (const FieldView &field : row) {
+          csv.back().push_back(field.str());
+        }
+      });
+  return csv;
+}
+
+TEST(CsvParserTest, ParallelReaderMatchesSequentialParse) {
+  const std::string input = make_mixed_csv(300 * 1024);
+  const CSV expected = parse_string(input);
+  for (const size_t chunk_size : {size_t(1), size_t(7), size_t(4096),
+                                  size_t(100 * 1024), size_t(1 << 20)}) {
+    EXPECT_EQ(parse_parallel(input, chunk_size), expected) << chunk_size;
+  }
+}
+
+TEST(CsvParserTest, ParallelReaderUnorderedRowsSortIntoInputOrder) {
+  const std::string input = make_mixed_csv(100 * 1024);
+  std::mutex mutex;
+  std::vector<std::pair<std::pair<size_t, size_t>, std::vector<std::string>>>
+      tagged;
+  ParallelReader(input.data(), input.size())
+      .threads(3)
+      .chunk_size(1000)
+      .for_each_row_unordered(
+          [&](const RowTag &tag, const std::vector<std::string> &row) {
+            std::lock_guard<std::mutex> lock(mutex);
+            tagged.emplace_back(std::make_pair(tag.chunk, tag.row), row);
+          });
+  std::sort(tagged.begin(), tagged.end());
+
+  CSV rows;
+  for (const auto &entry : tagged) {
+    rows.push_back(entry.second);
+  }
+  EXPECT_EQ(rows, parse_string(input));
+}
+
+TEST(CsvParserTest, ParallelReaderSkipsBomOnlyAtStart) {
+  const std::string input = "\xEF\xBB\xBF\"a\nb\",c\n1,2\n\xEF\xBB\xBFx,y\n";
+  CSV expected = {{"a\nb", "c"}, {"1", "2"}, {"\xEF\xBB\xBFx", "y"}};
+  EXPECT_EQ(parse_parallel(input, 2), expected);
+}
+
+TEST(CsvParserTest, ParallelReaderPropagatesCallbackErrors) {
+  const std::string input = make_mixed_csv(64 * 1024);
+  EXPECT_THROW(ParallelReader(input.data(), input.size())
+                   .chunk_size(512)
+                   .for_each_row([](const RowTag &tag, const RowView &) {
+                     if (tag.chunk == 3) {
+                       throw std::runtime_error("stop");
+                     }
+                   }),
+               std::runtime_error);
+}
+
+// Splits the input at every offset and checks that resolving a speculative
+// scan of the rest gives what a sequential scan from the start gives
+void expect_speculation_matches_sequential(const std::string &input,
+                                           const RowScanner &scanner) {
+  const char *data = input.data();
+  for (size_t split = 0; split <= input.size(); ++split) {
+    for (size_t end = split; end <= input.size(); end += 5) {
+      ScanState entry;
+      scanner.scan(data, 0, split, entry);
+
+      ScanState expected_end = entry;
+      const size_t expected_row_start =
+          scanner.find_row_start(data, split, end, expected_end);
+      scanner.scan(data, expected_row_start, end, expected_end);
+
+      const auto resolved =
+          ChunkSpeculation(scanner, data, split, end).resolve(entry);
+      EXPECT_EQ(resolved.row_start, expected_row_start) << split << "-" << end;
+      EXPECT_TRUE(resolved.end_state == expected_end) << split << "-" << end;
+    }
+  }
+}
+
+TEST(CsvParserTest, ChunkSpeculationMatchesSequentialScanOnTestData) {
+  const RowScanner scanner('"', ',', Term::CRLF);
+  for (const auto *name : kTestFiles) {
+    SCOPED_TRACE(name);
+    expect_speculation_matches_sequential(
+        read_file(std::string(TEST_DATA_DIR "/") + name), scanner);
+  }
+
+  SCOPED_TRACE("quote.csv");
+  expect_speculation_matches_sequential(read_file(TEST_DATA_DIR "/quote.csv"),
+                                        RowScanner('\'', ',', Term::CRLF));
+}
+
+TEST(CsvParserTest, ChunkSpeculationMatchesSequentialScanOnMixedInput) {
+  expect_speculation_matches_sequential(make_mixed_csv(400),
+                                        RowScanner('"', ',', Term::CRLF));
+}
+
+// Reads the CSV in batches and rebuilds the rows, dropping the empty fields
+// that pad short rows out to the batch width
+auto read_batched(CsvParser &p, size_t batch_rows) -> CSV {
+  CSV csv;
+  ColumnBatch batch;
+  while (p.next_batch(batch, batch_rows) != 0) {
+    EXPECT_LE(batch.rows(), batch_rows);
+    for (size_t col = 0; col < batch.columns(); ++col) {
+      EXPECT_EQ(batch.column(col).size(), batch.rows());
+    }
+    for (size_t row = 0; row < batch.rows(); ++row) {
+      std::vector<std::string> fields;
+      for (size_t col = 0; col < batch.columns(); ++col) {
+        fields.push_back(batch.column(col).str(row));
+      }
+      csv.push_back(fields);
+    }
+  }
+  return csv;
+}
+
+auto pad_rows(CSV csv, size_t batch_rows) -> CSV {
+  for (size_t first = 0; first < csv.size(); first += batch_rows) {
+    const size_t last = std::min(csv.size(), first + batch_rows);
+    size_t width = 0;
+    for (size_t row = first; row < last; ++row) {
+      width = std::max(width, csv[row].size());
+    }
+    for (size_t row = first; row < last; ++row) {
+      csv[row].resize(width);
+    }
+  }
+  return csv;
+}
+
+TEST(CsvParserTest, ColumnBatchesMatchRows) {
+  for (const size_t batch_rows : {1, 2, 1000}) {
+    SCOPED_TRACE(batch_rows);
+    expect_same_rows(
+        [&](const std::string &path) {
+          CsvParser batched = CsvParser::from_file(path);
+          return read_batched(batched, batch_rows);
+        },
+        [&](const std::string &path) {
+          return pad_rows(read_rows(path), batch_rows);
+        });
+  }
+}
+
+TEST(CsvParserTest, ColumnBatchPadsRaggedRows) {
+  std::istringstream stream("a\nb,c,\n\nd,\"\"");
+  CsvParser parser(stream);
+  ColumnBatch batch;
+
+  ASSERT_EQ(parser.next_batch(batch, 10), 4U);
+  ASSERT_EQ(batch.columns(), 3U);
+  const auto &first = batch.column(0);
+  const auto &second = batch.column(1);
+  const auto &third = batch.column(2);
+  EXPECT_EQ(first.str(0), "a");
+  EXPECT_EQ(first.str(1), "b");
+  EXPECT_EQ(first.str(3), "d");
+  EXPECT_EQ(second.str(1), "c");
+  EXPECT_TRUE(first.is_valid(0));
+  EXPECT_FALSE(second.is_valid(0));
+  EXPECT_FALSE(third.is_valid(0));
+  EXPECT_FALSE(third.is_valid(1));
+  EXPECT_FALSE(first.is_valid(2));
+  EXPECT_FALSE(second.is_valid(3));
+  EXPECT_EQ(parser.next_batch(batch, 10), 0U);
+  EXPECT_EQ(batch.rows(), 0U);
+  EXPECT_EQ(batch.columns(), 0U);
+}
+
+TEST(CsvParserTest, TypedReaderConvertsColumns) {
+  std::istringstream stream(
+      "id,price,ok,day,at,name\n"
+      "-9223372036854775808,1.5e3,TRUE,1970-01-02,2000-02-29T12:00:01.5Z,x\n"
+      "\n"
+      "12345678901234567,,0,1969-12-31,1970-01-01 00:00:00,\n");
+  CsvParser parser(stream);
+  TypedReader reader(parser,
+                     {ColumnType::INT64, ColumnType::DOUBLE, ColumnType::BOOL,
+                      ColumnType::DATE, ColumnType::TIMESTAMP,
+                      ColumnType::STRING});
+  std::vector<TypedValue> row;
+
+  ASSERT_TRUE(reader.skip_row());
+  ASSERT_TRUE(reader.next_row(row));
+  EXPECT_EQ(row[0].integer, INT64_MIN);
+  EXPECT_EQ(row[1].real, 1500.0);
+  EXPECT_TRUE(row[2].boolean);
+  EXPECT_EQ(row[3].integer, 1);
+  EXPECT_EQ(row[4].integer, 951825601500000LL);
+  EXPECT_EQ(row[5].text, "x");
+
+  ASSERT_TRUE(reader.next_row(row));
+  EXPECT_EQ(reader.rows(), 4U);
+  EXPECT_EQ(row[0].integer, 12345678901234567LL);
+  EXPECT_TRUE(row[1].null);
+  EXPECT_FALSE(row[2].boolean);
+  EXPECT_EQ(row[3].integer, -1);
+  EXPECT_EQ(row[4].integer, 0);
+  EXPECT_FALSE(row[5].null);
+  EXPECT_EQ(row[5].text, "");
+  EXPECT_FALSE(reader.next_row(row));
+}
+
+TEST(CsvParserTest, TypedReaderTakesFixedDialects) {
+  const std::string text = "1;2.5\n2;-0.25e100\n";
+  BasicCsvParser<FixedDialect<';'>> parser(text.data(), text.size());
+  BasicTypedReader<FixedDialect<';'>> reader(
+      parser, {ColumnType::INT64, ColumnType::DOUBLE});
+  std::vector<TypedValue> row;
+  ASSERT_TRUE(reader.next_row(row));
+  EXPECT_EQ(row[1].real, 2.5);
+  ASSERT_TRUE(reader.next_row(row));
+  EXPECT_EQ(row[0].integer, 2);
+  EXPECT_EQ(row[1].real, -0.25e100);
+  EXPECT_FALSE(reader.next_row(row));
+}
+
+TEST(CsvParserTest, TypedReaderIgnoresTheLocale) {
+  // strtod in these reads "1.5" as 1
+  const char *locales[] = {"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8",
+                           "fr_FR.utf8"};
+  const std::string previous = std::setlocale(LC_NUMERIC, nullptr);
+  bool found = false;
+  for (const char *locale : locales) {
+    if (std::setlocale(LC_NUMERIC, locale) != nullptr) {
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    GTEST_SKIP() << "No locale with a comma decimal point";
+  }
+
+  // Exact values, and ones with too many digits or too large an exponent
+  // for the fast path
+  const std::string text = "1.5\n1.5e100\n0.10000000000000000000001\n";
+  CsvParser parser(text.data(), text.size());
+  TypedReader reader(parser, {ColumnType::DOUBLE});
+  std::vector<double> values;
+  std::vector<TypedValue> row;
+  while (reader.next_row(row)) {
+    values.push_back(row[0].real);
+  }
+  std::setlocale(LC_NUMERIC, previous.c_str());
+  EXPECT_EQ(values, std::vector<double>({1.5, 1.5e100, 0.1}));
+}
+
+TEST(CsvParserTest, TypedReaderRejectsBadFields) {
+  const char *bad[] = {"9223372036854775808", "1.5", "-", "1e", "maybe",
+                       "2023-02-29", "2023-01-01T24:00:00"};
+  const ColumnType types[] = {ColumnType::INT64, ColumnType::INT64,
+                              ColumnType::INT64, ColumnType::DOUBLE,
+                              ColumnType::BOOL,  ColumnType::DATE,
+                              ColumnType::TIMESTAMP};
+  for (size_t i = 0; i < 7; ++i) {
+    std::istringstream stream(bad[i]);
+    CsvParser parser(stream);
+    TypedReader reader(parser, {types[i]});
+    std::vector<TypedValue> row;
+    EXPECT_THROW(reader.next_row(row), ConversionError) << bad[i];
+  }
+}
+
+TEST(CsvParserTest, ConversionErrorReportsWhere) {
+  std::istringstream stream("1,2\n3,x\n");
+  CsvParser parser(stream);
+  TypedReader reader(parser, {ColumnType::INT64, ColumnType::INT64});
+  std::vector<TypedValue> row;
+  ASSERT_TRUE(reader.next_row(row));
+  try {
+    reader.next_row(row);
+    FAIL() << "expected a ConversionError";
+  } catch (const ConversionError &e) {
+    EXPECT_EQ(e.row(), 1U);
+    EXPECT_EQ(e.column(), 1U);
+    EXPECT_EQ(e.position(), parser.position());
+    EXPECT_STREQ(e.what(),
+                 "Field \"x\" is not a valid int64 (row 1, column 1)");
+  }
+
+  std::istringstream short_stream("1\n");
+  CsvParser short_parser(short_stream);
+  TypedReader short_reader(short_parser,
+                           {ColumnType::INT64, ColumnType::INT64});
+  EXPECT_THROW(short_reader.next_row(row), ConversionError);
+}
+
+TEST(CsvParserTest, ArenaRowsMatchRows) {
+  expect_same_rows([](const std::string &path) {
+    CsvParser arena = CsvParser::from_file(path);
+    CSV csv;
+    ArenaRow row;
+    while (arena.next_row(row)) {
+      std::vector<std::string> fields;
+      for (size_t i = 0; i < row.size(); ++i) {
+        fields.push_back(row[i].str());
+      }
+      csv.push_back(fields);
+    }
+    return csv;
+  });
+}
+
+// Counts allocations made through it, to check that the arena stops
+// allocating once it fits the rows
+template <typename T> struct CountingAllocator {
+  using value_type = T;
+
+  explicit CountingAllocator(size_t *counter) : count(counter) {}
+  template <typename U>
+  CountingAllocator(const CountingAllocator<U> &other) : count(other.count) {}
+
+  auto allocate(size_t n) -> T * {
+    ++*count;
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T *p, size_t n) { std::allocator<T>().deallocate(p, n); }
+
+  auto operator==(const CountingAllocator &other) const -> bool {
+    return count == other.count;
+  }
+  auto operator!=(const CountingAllocator &other) const -> bool {
+    return count != other.count;
+  }
+
+  size_t *count;
+};
+
+TEST(CsvParserTest, ArenaRowStopsAllocating) {
+  const std::string line = std::string(300, 'x') + ",\"a\"\"b\"," +
+                           std::string(2000, 'y') + "\n";
+  std::string input;
+  for (int i = 0; i < 200; ++i) {
+    input += line;
+  }
+  std::istringstream stream(input);
+  CsvParser parser(stream);
+
+  size_t allocations = 0;
+  BasicArenaRow<CountingAllocator<char>> row{
+      CountingAllocator<char>(&allocations)};
+  ASSERT_TRUE(parser.next_row(row));
+  const size_t warm = allocations;
+  EXPECT_GT(warm, 0U);
+
+  size_t rows = 1;
+  while (parser.next_row(row)) {
+    ASSERT_EQ(row.size(), 3U);
+    EXPECT_EQ(row[1].str(), "a\"b");
+    rows++;
+  }
+  EXPECT_EQ(rows, 200U);
+  EXPECT_EQ(allocations, warm);
+}
+
+TEST(CsvParserTest, SourcesMatchStreams) {
+  expect_same_rows([](const std::string &path) {
+    const std::string text = read_file(path);
+    MemorySource memory(text.data(), text.size());
+    CsvParser from_memory(memory);
+    return read_all(from_memory);
+  });
+
+  // One to seven bytes per read, so BOMs, quotes and CRLFs get split
+  expect_same_rows([](const std::string &path) {
+    const std::string text = read_file(path);
+    size_t offset = 0;
+    size_t calls = 0;
+    CsvParser from_callback(std::unique_ptr<Source>(new CallbackSource(
+        [&](char *buffer, size_t size) -> size_t {
+          size_t count = std::min(size, 1 + calls++ % 7);
+          count = std::min(count, text.size() - offset);
+          std::memcpy(buffer, text.data() + offset, count);
+          offset += count;
+          return count;
+        })));
+    return read_all(from_callback);
+  });
+
+#if defined(ARIA_CSV_HAS_FD)
+  expect_same_rows([](const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    EXPECT_GE(fd, 0);
+    FdSource file(fd);
+    CsvParser from_fd(file);
+    const CSV csv = read_all(from_fd);
+    ::close(fd);
+    return csv;
+  });
+#endif
+}
+
+TEST(CsvParserTest, NullSourceIsRejected) {
+  EXPECT_THROW(CsvParser parser{std::unique_ptr<Source>()},
+               std::invalid_argument);
+}
+
+TEST(CsvParserTest, InPlaceBufferMatchesStream) {
+  expect_same_rows([](const std::string &path) {
+    const std::string text = read_file(path);
+    CsvParser in_place(text.data(), text.size());
+    return read_all(in_place);
+  });
+}
+
+TEST(CsvParserTest, InPlaceBufferViewsPointIntoIt) {
+  const std::string text = "abc,\"de\",\"f\"\"g\"\n";
+  CsvParser parser(text.data(), text.size());
+
+  const auto plain = parser.next_field_view();
+  EXPECT_EQ(plain.data, text.data());
+  EXPECT_EQ(plain.str(), "abc");
+  const auto quoted = parser.next_field_view();
+  EXPECT_EQ(quoted.data, text.data() + 5);
+  EXPECT_EQ(quoted.str(), "de");
+  EXPECT_EQ(parser.next_field_view().str(), "f\"g");
+  EXPECT_EQ(parser.next_field_view().type, FieldType::CSV_END);
+
+  CsvParser empty(nullptr, 0);
+  EXPECT_EQ(empty.next_field().type, FieldType::CSV_END);
+  EXPECT_THROW(CsvParser(nullptr, 1), std::invalid_argument);
+}
+
+TEST(CsvParserTest, ReadAheadSourceMatchesStream) {
+  const std::string text = make_mixed_csv(300 * 1024);
+  std::istringstream stream(text);
+  CsvParser streamed(stream);
+  const CSV expected = read_all(streamed);
+
+  for (const size_t buffers : {1, 3}) {
+    // Short reads of up to 5000 bytes, into small ring buffers
+    size_t offset = 0;
+    std::unique_ptr<Source> slow(new CallbackSource(
+        [&](char *buffer, size_t size) -> size_t {
+          const size_t count =
+              std::min(std::min(size, text.size() - offset), size_t(5000));
+          std::memcpy(buffer, text.data() + offset, count);
+          offset += count;
+          return count;
+        }));
+    CsvParser parser(std::unique_ptr<Source>(
+        new ReadAheadSource(std::move(slow), buffers, 4096)));
+    EXPECT_EQ(read_all(parser), expected) << buffers;
+  }
+}
+
+TEST(CsvParserTest, ReadAheadSourcePropagatesErrors) {
+  size_t calls = 0;
+  std::unique_ptr<Source> failing(
+      new CallbackSource([&](char *buffer, size_t) -> size_t {
+        if (calls++ == 2) {
+          throw std::runtime_error("disk went away");
+        }
+        std::memcpy(buffer, "a,b\n", 4);
+        return 4;
+      }));
+  CsvParser parser(
+      std::unique_ptr<Source>(new ReadAheadSource(std::move(failing))));
+
+  size_t rows = 0;
+  try {
+    for (const auto &row : parser) {
+      EXPECT_EQ(row.size(), 2U);
+      rows++;
+    }
+    FAIL() << "expected the source's error";
+  } catch (const std::runtime_error &e) {
+    EXPECT_STREQ(e.what(), "disk went away");
+  }
+  EXPECT_GE(rows, 1U);
+}
+
+TEST(CsvParserTest, ReadAheadSourceStopsWhenDroppedEarly) {
+  std::unique_ptr<Source> endless(
+      new CallbackSource([](char *buffer, size_t size) -> size_t {
+        for (size_t i = 0; i < size; ++i) {
+          buffer[i] = i % 2 == 0 ? 'x' : '\n';
+        }
+        return size;
+      }));
+  CsvParser parser(
+      std::unique_ptr<Source>(new ReadAheadSource(std::move(endless), 2, 64)));
+  EXPECT_EQ(parser.next_field_view().type, FieldType::DATA);
+}
+
+TEST(CsvParserTest, BufferSizesDontChangeFields) {
+  const std::string text = make_mixed_csv(20000);
+  std::istringstream stream(text);
+  CsvParser default_size(stream);
+  const auto expected = read_fields(default_size);
+
+  for (const size_t size : {16, 17, 100, 4096}) {
+    for (const auto engine :
+         {Engine::STATE_MACHINE, Engine::STRUCTURAL_INDEX}) {
+      std::istringstream sized_stream(text);
+      CsvParser sized =
+          CsvParser(sized_stream).buffer_size(size).engine(engine);
+      EXPECT_EQ(read_fields(sized), expected) << size;
+    }
+  }
+}
+
+// Parses text through a source that records the size of every read
+auto requested_read_sizes(const std::string &text, size_t min, size_t max)
+    -> std::vector<size_t> {
+  std::vector<size_t> sizes;
+  size_t offset = 0;
+  CsvParser parser =
+      CsvParser(std::unique_ptr<Source>(new CallbackSource(
+                    [&](char *buffer, size_t size) -> size_t {
+                      sizes.push_back(size);
+                      const size_t count =
+                          std::min(size, text.size() - offset);
+                      std::memcpy(buffer, text.data() + offset, count);
+                      offset += count;
+                      return count;
+                    })))
+          .adaptive_buffer_size(min, max);
+  read_fields(parser);
+  return sizes;
+}
+
+TEST(CsvParserTest, AdaptiveBufferFollowsFieldLength) {
+  std::string short_fields;
+  for (int i = 0; i < 20000; ++i) {
+    short_fields += "ab,cd\n";
+  }
+  const auto short_sizes = requested_read_sizes(short_fields, 1024, 65536);
+  EXPECT_EQ(*std::max_element(short_sizes.begin(), short_sizes.end()), 1024U);
+
+  std::string long_fields = std::string(100000, 'x') + ",y\n" +
+                            std::string(100000, 'z') + "\n";
+  // Enough short rows afterwards for 16 refills at the largest size
+  while (long_fields.size() < 2 * 1024 * 1024) {
+    long_fields += short_fields;
+  }
+  const auto long_sizes = requested_read_sizes(long_fields, 1024, 65536);
+  EXPECT_EQ(long_sizes.front(), 1024U);
+  EXPECT_EQ(*std::max_element(long_sizes.begin(), long_sizes.end()), 65536U);
+  // Back down once the long fields are over
+  EXPECT_LT(long_sizes.back(), 65536U);
+
+  std::istringstream stream("a");
+  EXPECT_THROW(CsvParser(stream).buffer_size(8), std::invalid_argument);
+  EXPECT_THROW(CsvParser(stream).adaptive_buffer_size(64, 32),
+               std::invalid_argument);
+}
+
+// Hands out text a few bytes at a time
+auto trickle_source(const std::string &text, size_t step)
+    -> std::unique_ptr<Source> {
+  std::shared_ptr<size_t> offset(new size_t(0));
+  return std::unique_ptr<Source>(
+      new CallbackSource([=](char *buffer, size_t size) -> size_t {
+        const size_t count =
+            std::min(std::min(size, step), text.size() - *offset);
+        std::memcpy(buffer, text.data() + *offset, count);
+        *offset += count;
+        return count;
+      }));
+}
+
+TEST(CsvParserTest, DecompressingSourcePassesPlainInput) {
+  const std::string text = make_mixed_csv(5000);
+  std::istringstream stream(text);
+  CsvParser plain(stream);
+  CsvParser detected(decompressing_source(trickle_source(text, 1)));
+  EXPECT_EQ(read_fields(detected), read_fields(plain));
+
+  CsvParser tiny(decompressing_source(trickle_source("a", 1)));
+  EXPECT_EQ(read_all(tiny), CSV({{"a"}}));
+  CsvParser empty(decompressing_source(trickle_source("", 1)));
+  EXPECT_EQ(read_all(empty), CSV());
+}
+
+#if defined(ARIA_CSV_WITH_ZLIB)
+auto gzip(const std::string &text) -> std::string {
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+               Z_DEFAULT_STRATEGY);
+  std::string output(deflateBound(&stream, text.size()), '\0');
+  stream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(text.data()));
+  stream.avail_in = static_cast<uInt>(text.size());
+  stream.next_out = reinterpret_cast<Bytef *>(&output[0]);
+  stream.avail_out = static_cast<uInt>(output.size());
+  deflate(&stream, Z_FINISH);
+  output.resize(stream.total_out);
+  deflateEnd(&stream);
+  return output;
+}
+
+TEST(CsvParserTest, GzipInputMatchesPlain) {
+  const std::string first = make_mixed_csv(20000);
+  const std::string second = make_mixed_csv(3000);
+  std::istringstream stream(first + second);
+  CsvParser plain(stream);
+  const auto expected = read_fields(plain);
+
+  // Two members, as `cat a.gz b.gz` would write
+  const std::string compressed = gzip(first) + gzip(second);
+  for (const size_t step : {1, 7, 65536}) {
+    CsvParser parser(
+        std::unique_ptr<Source>(new ReadAheadSource(decompressing_source(
+            trickle_source(compressed, step)))));
+    EXPECT_EQ(read_fields(parser), expected) << step;
+  }
+
+  // Output buffers smaller than what inflate() has ready
+  CsvParser small =
+      CsvParser(decompressing_source(trickle_source(compressed, 65536)))
+          .buffer_size(16);
+  EXPECT_EQ(read_fields(small), expected);
+}
+
+TEST(CsvParserTest, GzipErrorsAreReported) {
+  const std::string compressed = gzip(make_mixed_csv(5000));
+  CsvParser truncated(decompressing_source(
+      trickle_source(compressed.substr(0, compressed.size() / 2), 4096)));
+  EXPECT_THROW(read_fields(truncated), std::runtime_error);
+
+  std::string corrupt = compressed;
+  corrupt[12] = static_cast<char>(corrupt[12] ^ 0x55);
+  corrupt[13] = static_cast<char>(corrupt[13] ^ 0x55);
+  CsvParser invalid(decompressing_source(trickle_source(corrupt, 4096)));
+  EXPECT_THROW(read_fields(invalid), std::runtime_error);
+}
+#else
+TEST(CsvParserTest, GzipWithoutZlibIsRejected) {
+  EXPECT_THROW(decompressing_source(trickle_source("\x1F\x8B\x08", 3)),
+               std::runtime_error);
+}
+#endif
+
+#if defined(ARIA_CSV_WITH_ZSTD) || defined(ARIA_CSV_WITH_LZ4)
+// Reads the whole source with reads of read_size bytes
+auto drain(Source &source, size_t read_size) -> std::string {
+  std::string text;
+  std::vector<char> buffer(read_size);
+  size_t count = 0;
+  while ((count = source.read(buffer.data(), buffer.size())) != 0) {
+    text.append(buffer.data(), count);
+  }
+  return text;
+}
+
+// Checks that compressed text decompresses through open() at any read size,
+// including decompressed sizes that are exact multiples of the read size
+void expect_round_trips(
+    const std::function<std::string(const std::string &)> &compress,
+    const std::function<std::unique_ptr<Source>(std::unique_ptr<Source>)>
+        &open) {
+  for (const size_t size : {0, 8, 100000, 128 * 1024, 256 * 1024}) {
+    std::string text;
+    while (text.size() < size) {
+      text += "abc,def\n";
+    }
+    const std::string compressed = compress(text);
+
+    // Through the parser at its default buffer size, which the 128 and
+    // 256 KiB texts fill exactly
+    CsvParser plain(text.data(), text.size());
+    CsvParser parser(decompressing_source(trickle_source(compressed, 65536)));
+    EXPECT_EQ(read_fields(parser), read_fields(plain)) << size;
+
+    for (const size_t read_size : {1, 16, 65536, 128 * 1024}) {
+      const auto source = open(trickle_source(compressed, 4096));
+      EXPECT_EQ(drain(*source, read_size), text) << size << " " << read_size;
+    }
+  }
+
+  // Two frames back to back, as `cat a b` would write
+  const std::string first = make_mixed_csv(20000);
+  const std::string second = make_mixed_csv(3000);
+  const auto both = open(trickle_source(compress(first) + compress(second), 7));
+  EXPECT_EQ(drain(*both, 4096), first + second);
+
+  const std::string compressed = compress(make_mixed_csv(5000));
+  const auto truncated = open(
+      trickle_source(compressed.substr(0, compressed.size() / 2), 4096));
+  EXPECT_THROW(drain(*truncated, 4096), std::runtime_error);
+}
+#endif
+
+#if defined(ARIA_CSV_WITH_ZSTD)
+TEST(CsvParserTest, ZstdInputRoundTrips) {
+  expect_round_trips(
+      [](const std::string &text) {
+        std::string output(ZSTD_compressBound(text.size()), '\0');
+        output.resize(ZSTD_compress(&output[0], output.size(), text.data(),
+                                    text.size(), 3));
+        return output;
+      },
+      [](std::unique_ptr<Source> source) {
+        return std::unique_ptr<Source>(new ZstdSource(std::move(source)));
+      });
+}
+#endif
+
+#if defined(ARIA_CSV_WITH_LZ4)
+TEST(CsvParserTest, Lz4InputRoundTrips) {
+  expect_round_trips(
+      [](const std::string &text) {
+        std::string output(LZ4F_compressFrameBound(text.size(), nullptr),
+                           '\0');
+        output.resize(LZ4F_compressFrame(&output[0], output.size(),
+                                         text.data(), text.size(), nullptr));
+        return output;
+      },
+      [](std::unique_ptr<Source> source) {
+        return std::unique_ptr<Source>(new Lz4Source(std::move(source)));
+      });
+}
+#endif
+
+TEST(CsvParserTest, RowIndexFindsEveryRow) {
+  const std::string text = "\xEF\xBB\xBF" + make_mixed_csv(20000);
+  CsvParser full(text.data(), text.size());
+  const CSV rows = read_all(full);
+
+  const RowIndex index = RowIndex::build(text.data(), text.size(), 1);
+  ASSERT_EQ(index.rows(), rows.size());
+  EXPECT_EQ(index.bytes(), text.size());
+  for (size_t row = 0; row < rows.size(); ++row) {
+    for (const auto engine :
+         {Engine::STATE_MACHINE, Engine::STRUCTURAL_INDEX}) {
+      CsvParser parser = CsvParser(text.data(), text.size())
+                             .engine(engine)
+                             .start_at(static_cast<std::streamoff>(
+                                 index.checkpoint(row).offset));
+      ASSERT_EQ(*parser.begin(), rows[row]) << row;
+    }
+  }
+}
+
+TEST(CsvParserTest, StartAtRowMatchesFullParse) {
+  const std::string text = make_mixed_csv(20000);
+  CsvParser full(text.data(), text.size());
+  const CSV rows = read_all(full);
+  const RowIndex index = RowIndex::build(text.data(), text.size(), 16);
+  EXPECT_EQ(index.checkpoint(40).row, 32U);
+
+  for (const size_t row : {size_t(0), size_t(1), size_t(15), size_t(16),
+                           size_t(17), rows.size() / 2, rows.size() - 1}) {
+    CsvParser parser =
+        CsvParser(text.data(), text.size()).start_at_row(index, row);
+    EXPECT_EQ(read_all(parser), CSV(rows.begin() + row, rows.end())) << row;
+  }
+  EXPECT_THROW(CsvParser(text.data(), text.size())
+                   .start_at_row(index, rows.size()),
+               std::out_of_range);
+}
+
+TEST(CsvParserTest, RowIndexFromSourceMatchesMemory) {
+  const std::string text = "\xEF\xBB\xBF" + make_mixed_csv(5000);
+  const RowIndex expected = RowIndex::build(text.data(), text.size(), 3);
+  for (const size_t step : {1, 2, 5, 4096}) {
+    const auto source = trickle_source(text, step);
+    const RowIndex index = RowIndex::build(*source, 3);
+    ASSERT_EQ(index.rows(), expected.rows()) << step;
+    EXPECT_EQ(index.bytes(), expected.bytes());
+    for (uint64_t row = 0; row < index.rows(); row += 3) {
+      EXPECT_EQ(index.checkpoint(row).offset,
+                expected.checkpoint(row).offset)
+          << row;
+    }
+  }
+
+  const std::string crlf = "a\r\nb\r\n\r\nc";
+  const RowIndex split = RowIndex::build(*trickle_source(crlf, 1), 1);
+  ASSERT_EQ(split.rows(), 4U);
+  EXPECT_EQ(split.checkpoint(1).offset, 3U);
+  EXPECT_EQ(split.checkpoint(2).offset, 6U);
+  EXPECT_EQ(split.checkpoint(3).offset, 8U);
+  EXPECT_EQ(RowIndex::build("", 0).rows(), 0U);
+  EXPECT_EQ(RowIndex::build("a\n", 2).rows(), 1U);
+}
+
+TEST(CsvParserTest, RowIndexSurvivesSaveAndLoad) {
+  const std::string text = make_mixed_csv(20000);
+  const RowIndex index = RowIndex::build(text.data(), text.size(), 10);
+  const std::string path = ::testing::TempDir() + "aria_csv_rows.idx";
+  index.save(path);
+
+  const RowIndex loaded = RowIndex::load(path);
+  EXPECT_EQ(loaded.rows(), index.rows());
+  EXPECT_EQ(loaded.stride(), index.stride());
+  EXPECT_EQ(loaded.bytes(), index.bytes());
+  for (uint64_t row = 0; row < index.rows(); row += 10) {
+    EXPECT_EQ(loaded.checkpoint(row).offset, index.checkpoint(row).offset);
+  }
+
+  {
+    std::ofstream truncate(path, std::ios::binary | std::ios::app);
+    truncate << 'x';
+  }
+  EXPECT_THROW(RowIndex::load(path), std::runtime_error);
+  {
+    std::ofstream other(path, std::ios::binary | std::ios::trunc);
+    other << "a,b\n";
+  }
+  EXPECT_THROW(RowIndex::load(path), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST(CsvParserTest, StartAtSkipsAnySource) {
+  const std::string text = "a,b\n\"c\nd\",e\nf,g\n";
+  const CSV tail = {{"c\nd", "e"}, {"f", "g"}};
+
+  std::istringstream seekable(text);
+  CsvParser stream_parser = CsvParser(seekable).start_at(4);
+  EXPECT_EQ(read_all(stream_parser), tail);
+
+  CsvParser callback_parser = CsvParser(trickle_source(text, 3)).start_at(4);
+  EXPECT_EQ(read_all(callback_parser), tail);
+
+  CsvParser memory_parser = CsvParser(text.data(), text.size()).start_at(4);
+  EXPECT_EQ(memory_parser.next_field().data, "c\nd");
+  EXPECT_EQ(memory_parser.position(), 10);
+
+  // Past the end is simply empty
+  std::istringstream short_stream(text);
+  CsvParser past = CsvParser(short_stream).start_at(1000);
+  EXPECT_EQ(read_all(past), CSV());
+
+  std::istringstream started(text);
+  CsvParser parser(started);
+  parser.next_field();
+  EXPECT_THROW(parser.start_at(4), std::logic_error);
+  EXPECT_THROW(CsvParser(text.data(), text.size()).start_at(-1),
+               std::invalid_argument);
+}
+
+TEST(CsvParserTest, CountRowsMatchesIteratorOnTestData) {
+  struct Case {
+    const char *name;
+    RuntimeDialect dialect;
+  };
+  std::vector<Case> cases = {
+      {"delimiter.csv", RuntimeDialect('"', ';', Term::CRLF)},
+      {"terminator.csv", RuntimeDialect('"', ',', static_cast<Term>(';'))},
+      {"quote.csv", RuntimeDialect('\'', ',', Term::CRLF)}};
+  for (const auto *name : kTestFiles) {
+    cases.push_back({name, RuntimeDialect()});
+  }
+  for (const auto &c : cases) {
+    const std::string path = std::string(TEST_DATA_DIR "/") + c.name;
+    const auto configure = [&](CsvParser &&parser) -> CsvParser {
+      return std::move(parser)
+          .quote(c.dialect.quote)
+          .delimiter(c.dialect.delimiter)
+          .terminator(static_cast<char>(c.dialect.terminator));
+    };
+    CsvParser rows = configure(CsvParser::from_file(path));
+    const uint64_t expected = read_all(rows).size();
+
+    CsvParser streamed = configure(CsvParser::from_file(path));
+    EXPECT_EQ(streamed.count_rows(), expected) << c.name;
+    CsvParser mapped = configure(CsvParser::from_mapped_file(path));
+    EXPECT_EQ(mapped.count_rows(), expected) << c.name;
+    CsvParser tiny = configure(CsvParser::from_file(path)).buffer_size(16);
+    EXPECT_EQ(tiny.count_rows(), expected) << c.name;
+
+    const std::string text = read_file(path);
+    EXPECT_EQ(ParallelReader(text.data(), text.size())
+                  .quote(c.dialect.quote)
+                  .delimiter(c.dialect.delimiter)
+                  .terminator(static_cast<char>(c.dialect.terminator))
+                  .chunk_size(4)
+                  .count_rows(),
+              expected)
+        << c.name;
+  }
+}
+
+TEST(CsvParserTest, CountRowsMatchesIteratorOnMixedInput) {
+  for (const size_t size : {0, 1, 2, 3, 17, 1000, 300 * 1024}) {
+    const std::string text = make_mixed_csv(size);
+    const uint64_t expected = parse_string(text).size();
+    CsvParser in_place(text.data(), text.size());
+    EXPECT_EQ(in_place.count_rows(), expected) << size;
+    CsvParser trickled = CsvParser(trickle_source(text, 1)).buffer_size(16);
+    EXPECT_EQ(trickled.count_rows(), expected) << size;
+    for (const size_t chunk_size : {size_t(1), size_t(4096)}) {
+      EXPECT_EQ(ParallelReader(text.data(), text.size())
+                    .threads(4)
+                    .chunk_size(chunk_size)
+                    .count_rows(),
+                expected)
+          << size;
+    }
+  }
+
+  const std::string bom_only = "\xEF\xBB\xBF";
+  EXPECT_EQ(ParallelReader(bom_only.data(), bom_only.size()).count_rows(), 0U);
+}
+
+TEST(CsvParserTest, CountRowsFromRowBoundaries) {
+  const std::string text = "a,b\n\"c\r\nd\",e\r\n\nf";
+  CsvParser parser(text.data(), text.size());
+  EXPECT_EQ(parser.next_field().data, "a");
+  EXPECT_THROW(parser.count_rows(), std::logic_error);
+
+  CsvParser after_last_field(text.data(), text.size());
+  after_last_field.next_field();
+  after_last_field.next_field();
+  EXPECT_EQ(after_last_field.count_rows(), 3U);
+  EXPECT_TRUE(after_last_field.empty());
+  EXPECT_EQ(after_last_field.count_rows(), 0U);
+
+  CsvParser after_row_end(text.data(), text.size());
+  while (after_row_end.next_field().type != FieldType::ROW_END) {
+  }
+  EXPECT_EQ(after_row_end.count_rows(), 3U);
+
+  CsvParser started = CsvParser(text.data(), text.size()).start_at(4);
+  EXPECT_EQ(started.count_rows(), 3U);
+}
+
+// The fields of the selected columns of every row, in column order
+auto project(const CSV &rows, std::vector<size_t> columns) -> CSV {
+  std::sort(columns.begin(), columns.end());
+  CSV projected;
+  for (const auto &row : rows) {
+    projected.emplace_back();
+    for (const size_t column : columns) {
+      if (column < row.size()) {
+        projected.back().push_back(row[column]);
+      }
+    }
+  }
+  return projected;
+}
+
+TEST(CsvParserTest, SelectedColumnsMatchFullRows) {
+  const std::string text = make_mixed_csv(50000);
+  const CSV rows = parse_string(text);
+  const std::vector<std::vector<size_t>> selections = {
+      {0}, {1}, {3, 1}, {0, 2, 4, 6}, {5}, {40}};
+  for (const auto &columns : selections) {
+    const CSV expected = project(rows, columns);
+    for (const auto engine :
+         {Engine::STATE_MACHINE, Engine::STRUCTURAL_INDEX}) {
+      CsvParser in_place = CsvParser(text.data(), text.size())
+                               .engine(engine)
+                               .select_columns(columns);
+      EXPECT_EQ(read_all(in_place), expected) << columns[0];
+      CsvParser trickled = CsvParser(trickle_source(text, 7))
+                               .buffer_size(16)
+                               .engine(engine)
+                               .select_columns(columns);
+      EXPECT_EQ(read_all(trickled), expected) << columns[0];
+    }
+  }
+
+  // A last row without any of the columns, and without a terminator
+  const std::string short_last_text = "a,b,c\nd";
+  CsvParser short_last =
+      CsvParser(short_last_text.data(), short_last_text.size())
+          .select_columns({2});
+  EXPECT_EQ(read_all(short_last), CSV({{"c"}, {}}));
+}
+
+// Feeds the text to a push parser in chunks of chunk_size bytes, each one a
+// copy that is freed right after feed()
+auto push_fields(const std::string &text, size_t chunk_size,
+                 PushParser parser = PushParser())
+    -> std::vector<std::pair<FieldType, std::string>> {
+  std::vector<std::pair<FieldType, std::string>> fields;
+  const auto collect = [&fields](const FieldView &field) {
+    fields.emplace_back(field.type, field.type == FieldType::DATA
+                                        ? field.str()
+                                        : std::string());
+  };
+  for (size_t offset = 0; offset < text.size(); offset += chunk_size) {
+    const std::string chunk = text.substr(offset, chunk_size);
+    parser.feed(chunk.data(), chunk.size(), collect);
+  }
+  parser.finish(collect);
+  return fields;
+}
+
+TEST(CsvParserTest, PushParserMatchesPullParser) {
+  for (const auto *name : kTestFiles) {
+    const std::string text = read_file(std::string(TEST_DATA_DIR "/") + name);
+    CsvParser pull(text.data(), text.size());
+    const auto expected = read_fields(pull);
+    for (const size_t chunk_size : {1, 2, 3, 5, 64}) {
+      EXPECT_EQ(push_fields(text, chunk_size), expected) << name;
+    }
+  }
+
+  const std::string mixed = make_mixed_csv(20000);
+  CsvParser pull(mixed.data(), mixed.size());
+  const auto expected = read_fields(pull);
+  for (const size_t chunk_size : {1, 7, 4096}) {
+    EXPECT_EQ(push_fields(mixed, chunk_size), expected) << chunk_size;
+  }
+
+  const std::string semicolons = "a;'b\n;c'\n'it''s';\"\n";
+  CsvParser custom = CsvParser(semicolons.data(), semicolons.size())
+                         .delimiter(';')
+                         .quote('\'')
+                         .terminator('\n');
+  EXPECT_EQ(push_fields(semicolons, 1, PushParser()
+                                          .delimiter(';')
+                                          .quote('\'')
+                                          .terminator('\n')),
+            read_fields(custom));
+}
+
+TEST(CsvParserTest, PushParserResumesAcrossChunks) {
+  PushParser parser;
+  std::vector<std::string> events;
+  const auto collect = [&events](const FieldView &field) {
+    events.push_back(field.type == FieldType::DATA       ? field.str()
+                     : field.type == FieldType::ROW_END ? "<row>"
+                                                        : "<end>");
+  };
+  // A CRLF split after the '\r' and a quoted field split by a chunk
+  parser.feed("a,\"b\r", 5, collect);
+  EXPECT_EQ(events, std::vector<std::string>({"a"}));
+  parser.feed("\n\"\"c\"\r", 6, collect);
+  EXPECT_EQ(events, std::vector<std::string>({"a", "b\r\n\"c"}));
+  parser.feed("\nd", 2, collect);
+  EXPECT_EQ(events, std::vector<std::string>({"a", "b\r\n\"c", "<row>"}));
+  EXPECT_EQ(parser.position(), 13);
+  parser.finish(collect);
+  EXPECT_EQ(events, std::vector<std::string>(
+                        {"a", "b\r\n\"c", "<row>", "d", "<end>"}));
+  EXPECT_THROW(parser.feed("x", 1, collect), std::logic_error);
+  EXPECT_THROW(parser.finish(collect), std::logic_error);
+}
+
+#if defined(ARIA_CSV_HAS_COROUTINES)
+auto rows_of(Generator<const ArenaRow &> rows) -> CSV {
+  CSV csv;
+  for (const ArenaRow &row : rows) {
+    csv.emplace_back();
+    for (size_t i = 0; i < row.size(); ++i) {
+      csv.back().push_back(row[i].str());
+    }
+  }
+  return csv;
+}
+
+TEST(CsvParserTest, GeneratedRowsMatchReadRows) {
+  const std::string mixed = make_mixed_csv(20000);
+  CsvParser pull(mixed.data(), mixed.size());
+  const CSV expected = read_all(pull);
+
+  CsvParser parser(mixed.data(), mixed.size());
+  EXPECT_EQ(rows_of(parser.generate_rows()), expected);
+
+  // The rows each chunk completes, then the last one at finish
+  for (const size_t chunk_size : {1, 7, 4096}) {
+    PushParser push;
+    CSV rows;
+    for (size_t offset = 0; offset < mixed.size(); offset += chunk_size) {
+      const std::string chunk = mixed.substr(offset, chunk_size);
+      const CSV completed = rows_of(push.rows(chunk.data(), chunk.size()));
+      rows.insert(rows.end(), completed.begin(), completed.end());
+    }
+    const CSV last = rows_of(push.finish_rows());
+    rows.insert(rows.end(), last.begin(), last.end());
+    EXPECT_EQ(rows, expected) << chunk_size;
+  }
+
+  PushParser push;
+  EXPECT_EQ(rows_of(push.rows("\xEF\xBB\xBF" "a,b\nc", 8)), CSV({{"a", "b"}}));
+  EXPECT_EQ(rows_of(push.finish_rows()), CSV({{"c"}}));
+  EXPECT_THROW(push.rows("d", 1), std::logic_error);
+}
+#endif
+
+TEST(CsvParserTest, WriterQuotesOnlyWhenNeeded) {
+  std::ostringstream out;
+  {
+    CsvWriter writer(out);
+    writer.write_row({"a", "b,c", "say \"hi\"", "x\ry", "x\ny", ""});
+    writer.write_row({""});
+    writer.write_row(std::vector<std::string>{});
+    writer.write_field(FieldView("view", 4));
+    writer.write_field(std::string(300, 'z'));
+    writer.end_row();
+  }
+  EXPECT_EQ(out.str(), "a,\"b,c\",\"say \"\"hi\"\"\",\"x\ry\",\"x\ny\",\r\n"
+                       "\"\"\r\n"
+                       "\r\n"
+                       "view," +
+                           std::string(300, 'z') + "\r\n");
+
+  // The parser's dialect, and output handed over in small pieces
+  const std::string text = "a;'b;c'\n'it''s';\"\n";
+  CsvParser parser = CsvParser(text.data(), text.size())
+                         .delimiter(';')
+                         .quote('\'')
+                         .terminator('\n');
+  std::string written;
+  size_t calls = 0;
+  {
+    CsvWriter writer = CsvWriter([&](const char *data, size_t size) {
+                         written.append(data, size);
+                         calls++;
+                       })
+                           .dialect(parser.dialect())
+                           .buffer_size(4);
+    for (const auto &row : parser) {
+      writer.write_row(row);
+    }
+  }
+  EXPECT_EQ(written, text);
+  EXPECT_GT(calls, 3U);
+
+  std::string tabs;
+  {
+    BasicCsvWriter<FixedDialect<'\t', '"', static_cast<Term>('\n')>> writer(
+        [&](const char *data, size_t size) { tabs.append(data, size); });
+    writer.write_row({"a\tb", "c\rd", "e,f"});
+  }
+  EXPECT_EQ(tabs, "\"a\tb\"\tc\rd\te,f\n");
+}
+
+TEST(CsvParserTest, WrittenRowsParseBack) {
+  const std::string text = make_mixed_csv(100000);
+  for (const auto &dialect :
+       {RuntimeDialect('"', ',', Term::CRLF),
+        RuntimeDialect('\'', ';', static_cast<Term>('\n')),
+        RuntimeDialect('"', ',', static_cast<Term>('\r'))}) {
+    CsvParser parser = CsvParser(text.data(), text.size())
+                           .quote(dialect.quote)
+                           .delimiter(dialect.delimiter)
+                           .terminator(static_cast<char>(dialect.terminator));
+    const CSV rows = read_all(parser);
+
+    std::ostringstream out;
+    {
+      CsvWriter writer = CsvWriter(out).dialect(dialect).buffer_size(64);
+      for (const auto &row : rows) {
+        writer.write_row(row);
+      }
+    }
+    const std::string written = out.str();
+    CsvParser reread = CsvParser(written.data(), written.size())
+                           .quote(dialect.quote)
+                           .delimiter(dialect.delimiter)
+                           .terminator(static_cast<char>(dialect.terminator));
+    EXPECT_EQ(read_all(reread), rows) << dialect.delimiter;
+  }
+}
+
+TEST(CsvParserTest, HeaderFindsEveryName) {
+  std::vector<std::string> names;
+  for (size_t column = 0; column < 1000; ++column) {
+    names.push_back("column " + std::to_string(column));
+  }
+  names.push_back("column 7");
+  names.push_back("");
+  const Header header(names);
+  EXPECT_EQ(header.size(), 1002U);
+  for (size_t column = 0; column < 1000; ++column) {
+    EXPECT_EQ(header.index(names[column]), column);
+  }
+  EXPECT_EQ(header.index("column 7"), 7U);
+  EXPECT_EQ(header.index(""), 1001U);
+  EXPECT_FALSE(header.contains("column 1000"));
+  EXPECT_THROW(header.index("column"), std::out_of_range);
+  EXPECT_FALSE(Header().contains(""));
+}
+
+TEST(CsvParserTest, NamedRowsLookUpFieldsByName) {
+  const std::string text = "\xEF\xBB\xBFid,name,score\r\n1,\"a,b\",2.5\r\n2,c\r\n";
+  CsvParser parser(text.data(), text.size());
+  CSV rows;
+  for (const auto &row : parser.named_rows()) {
+    rows.push_back({row["id"], row[std::string("name")]});
+    const char *name = "name";
+    EXPECT_EQ(row[0], row["id"]);
+    EXPECT_EQ(row[1], row[name]);
+    EXPECT_EQ(row[size_t{0}], row[0u]);
+    EXPECT_EQ(row.header().index("score"), 2U);
+    if (row.size() == 3) {
+      EXPECT_EQ(row["score"], "2.5");
+    } else {
+      EXPECT_THROW(row["score"], std::out_of_range);
+    }
+    EXPECT_THROW(row["missing"], std::out_of_range);
+  }
+  EXPECT_EQ(rows, CSV({{"1", "a,b"}, {"2", "c"}}));
+  EXPECT_EQ(parser.header().names(),
+            std::vector<std::string>({"id", "name", "score"}));
+  EXPECT_THROW(parser.read_header(), std::logic_error);
+
+  // The header isn't projected or filtered, and header() follows the
+  // selected columns
+  CsvParser projected = CsvParser(text.data(), text.size())
+                            .select_columns({2, 0})
+                            .where(1, Predicate::equals("c"))
+                            .read_header();
+  EXPECT_EQ(projected.header().names(),
+            std::vector<std::string>({"id", "score"}));
+  rows.clear();
+  for (const auto &row : projected.named_rows()) {
+    rows.push_back({row["id"], std::to_string(row.size())});
+  }
+  EXPECT_EQ(rows, CSV({{"2", "1"}}));
+
+  CsvParser by_name = CsvParser(text.data(), text.size())
+                          .where("name", Predicate::starts_with("a"))
+                          .select_columns(std::vector<std::string>{"score"});
+  EXPECT_EQ(read_all(by_name), CSV({{"2.5"}}));
+  EXPECT_THROW(CsvParser(text.data(), text.size())
+                   .where("nope", Predicate::equals("")),
+               std::invalid_argument);
+}
+
+TEST(CsvParserTest, PredicatesMatchFields) {
+  const auto matches = [](const Predicate &predicate, const std::string &s) {
+    return predicate.matches(s.data(), s.size());
+  };
+  EXPECT_TRUE(matches(Predicate::equals("abc"), "abc"));
+  EXPECT_FALSE(matches(Predicate::equals("abc"), "ab"));
+  EXPECT_FALSE(matches(Predicate::equals("abc"), "abcd"));
+  EXPECT_TRUE(matches(Predicate::equals(""), ""));
+  EXPECT_TRUE(matches(Predicate::starts_with("ab"), "abc"));
+  EXPECT_TRUE(matches(Predicate::starts_with(""), ""));
+  EXPECT_FALSE(matches(Predicate::starts_with("abc"), "ab"));
+  EXPECT_TRUE(matches(Predicate::between(-1.5, 10), "-1.5"));
+  EXPECT_TRUE(matches(Predicate::between(-1.5, 10), "1e1"));
+  EXPECT_FALSE(matches(Predicate::between(-1.5, 10), "10.01"));
+  EXPECT_FALSE(matches(Predicate::between(-1.5, 10), "5x"));
+  EXPECT_FALSE(matches(Predicate::between(-1.5, 10), ""));
+}
+
+// The rows that have a field in the column and whose field passes
+auto filter(const CSV &rows, size_t column, const Predicate &predicate)
+    -> CSV {
+  CSV filtered;
+  for (const auto &row : rows) {
+    if (column < row.size() &&
+        predicate.matches(row[column].data(), row[column].size())) {
+      filtered.push_back(row);
+    }
+  }
+  return filtered;
+}
+
+TEST(CsvParserTest, FilteredRowsMatchFullRows) {
+  const std::string text = make_mixed_csv(50000);
+  const CSV rows = parse_string(text);
+  const std::vector<std::pair<size_t, Predicate>> filters = {
+      {0, Predicate::equals("abc")},
+      {1, Predicate::starts_with("q")},
+      {2, Predicate::equals("")},
+      {0, Predicate::starts_with("a\"")},
+      {4, Predicate::between(0, 1)}};
+  for (const auto &entry : filters) {
+    const CSV expected = filter(rows, entry.first, entry.second);
+    for (const auto engine :
+         {Engine::STATE_MACHINE, Engine::STRUCTURAL_INDEX}) {
+      CsvParser in_place = CsvParser(text.data(), text.size())
+                               .engine(engine)
+                               .where(entry.first, entry.second);
+      EXPECT_EQ(read_all(in_place), expected) << entry.first;
+      CsvParser trickled = CsvParser(trickle_source(text, 7))
+                               .buffer_size(16)
+                               .engine(engine)
+                               .where(entry.first, entry.second);
+      EXPECT_EQ(read_all(trickled), expected) << entry.first;
+    }
+
+    CsvParser counted = CsvParser(text.data(), text.size())
+                            .where(entry.first, entry.second);
+    EXPECT_EQ(counted.count_rows(), expected.size()) << entry.first;
+
+    CsvParser batched = CsvParser(text.data(), text.size())
+                            .where(entry.first, entry.second);
+    EXPECT_EQ(read_batched(batched, 64), pad_rows(expected, 64));
+
+    CsvParser arena = CsvParser(text.data(), text.size())
+                          .where(entry.first, entry.second);
+    CSV arena_rows;
+    ArenaRow row;
+    while (arena.next_row(row)) {
+      arena_rows.emplace_back();
+      for (size_t i = 0; i < row.size(); ++i) {
+        arena_rows.back().push_back(row[i].str());
+      }
+    }
+    EXPECT_EQ(arena_rows, expected) << entry.first;
+
+    // Filtering on a column that isn't selected, and on one that is
+    for (const size_t selected : {size_t{1}, entry.first}) {
+      CsvParser projected = CsvParser(text.data(), text.size())
+                                .select_columns({selected})
+                                .where(entry.first, entry.second);
+      EXPECT_EQ(read_all(projected), project(expected, {selected}));
+    }
+  }
+
+  // Predicates on two columns, and a last row without a terminator
+  const std::string two_text = "a,1\nb,2\na,3\na,x\na";
+  CsvParser two = CsvParser(two_text.data(), two_text.size())
+                      .where(0, Predicate::equals("a"))
+                      .where(1, Predicate::between(2, 5));
+  EXPECT_EQ(read_all(two), CSV({{"a", "3"}}));
+  const std::string last_text = "a,1\nb,2";
+  CsvParser last = CsvParser(last_text.data(), last_text.size())
+                       .where(0, Predicate::equals("b"));
+  EXPECT_EQ(read_all(last), CSV({{"b", "2"}}));
+}
+
+TEST(CsvParserTest, FilteredRowsAreSkippedByTypedReader) {
+  const std::string text = "1,x\n2,y\n3,x\n";
+  CsvParser parser =
+      CsvParser(text.data(), text.size()).where(1, Predicate::equals("x"));
+  TypedReader reader(parser, {ColumnType::INT64, ColumnType::STRING});
+  std::vector<TypedValue> row;
+  ASSERT_TRUE(reader.next_row(row));
+  EXPECT_EQ(row[0].integer, 1);
+  ASSERT_TRUE(reader.next_row(row));
+  EXPECT_EQ(row[0].integer, 3);
+  EXPECT_FALSE(reader.next_row(row));
+  EXPECT_EQ(reader.rows(), 3U);
+
+  CsvParser views =
+      CsvParser(text.data(), text.size()).where(1, Predicate::equals("y"));
+  EXPECT_EQ(views.next_field_view().str(), "1");
+  EXPECT_EQ(views.next_field_view().type, FieldType::ROW_END);
+  EXPECT_TRUE(views.row_rejected());
+  EXPECT_EQ(views.next_field_view().str(), "2");
+  EXPECT_EQ(views.next_field_view().str(), "y");
+  EXPECT_EQ(views.next_field_view().type, FieldType::ROW_END);
+  EXPECT_FALSE(views.row_rejected());
+}
+
+TEST(CsvParserTest, SelectColumnsByName) {
+  const std::string text = "id,name,score\r\n1,\"a,b\",2.5\r\n2,c,3\r\n";
+  std::istringstream stream(text);
+  CsvParser parser = CsvParser(stream).select_columns(
+      std::vector<std::string>{"score", "id"});
+  EXPECT_EQ(read_all(parser), CSV({{"1", "2.5"}, {"2", "3"}}));
+
+  std::istringstream typed_stream(text);
+  CsvParser typed_parser = CsvParser(typed_stream).select_columns(
+      std::vector<std::string>{"id", "score"});
+  TypedReader reader(typed_parser, {ColumnType::INT64, ColumnType::DOUBLE});
+  std::vector<TypedValue> row;
+  ASSERT_TRUE(reader.next_row(row));
+  EXPECT_EQ(row[0].integer, 1);
+  EXPECT_EQ(row[1].real, 2.5);
+
+  std::istringstream missing(text);
+  EXPECT_THROW(
+      CsvParser(missing).select_columns(std::vector<std::string>{"nope"}),
+      std::invalid_argument);
+}
+
+// Collects what parse() hands a visitor into rows
+struct RowVisitor {
+  CSV rows;
+  std::vector<std::string> row;
+
+  void on_field(const char *data, size_t size) {
+    row.emplace_back(data, size);
+  }
+  void on_row_end() {
+    rows.push_back(row);
+    row.clear();
+  }
+};
+
+TEST(CsvParserTest, VisitorSeesEveryRow) {
+  const std::string text = make_mixed_csv(20000);
+  const CSV rows = parse_string(text);
+  for (const auto engine : {Engine::STATE_MACHINE, Engine::STRUCTURAL_INDEX}) {
+    RowVisitor in_place;
+    CsvParser(text.data(), text.size()).engine(engine).parse(in_place);
+    EXPECT_EQ(in_place.rows, rows);
+    EXPECT_TRUE(in_place.row.empty());
+
+    RowVisitor trickled;
+    CsvParser(trickle_source(text, 7))
+        .buffer_size(16)
+        .engine(engine)
+        .parse(trickled);
+    EXPECT_EQ(trickled.rows, rows);
+  }
+
+  RowVisitor projected;
+  CsvParser(text.data(), text.size()).select_columns({2, 0}).parse(projected);
+  EXPECT_EQ(projected.rows, project(rows, {0, 2}));
+
+  const Predicate predicate = Predicate::starts_with("q");
+  RowVisitor filtered;
+  CsvParser(text.data(), text.size()).where(1, predicate).parse(filtered);
+  EXPECT_EQ(filtered.rows, filter(rows, 1, predicate));
+
+  // The rest of the input, after the rows already read
+  const std::string small = "a,b\nc\n\"d\"\"\",e";
+  CsvParser parser(small.data(), small.size());
+  Field field = parser.next_field();
+  while (field.type != FieldType::ROW_END) {
+    field = parser.next_field();
+  }
+  RowVisitor rest;
+  parser.parse(rest);
+  EXPECT_EQ(rest.rows, CSV({{"c"}, {"d\"", "e"}}));
+}
+
+// Puts the rows back together from batches of at most capacity fields
+auto read_field_batches(CsvParser &parser, size_t capacity) -> CSV {
+  CSV rows;
+  std::vector<std::string> row;
+  std::vector<FieldView> fields(capacity);
+  size_t count = 0;
+  while ((count = parser.next_fields(fields.data(), capacity)) != 0) {
+    EXPECT_LE(count, capacity);
+    for (size_t i = 0; i < count; ++i) {
+      if (fields[i].type == FieldType::DATA) {
+        row.push_back(fields[i].str());
+      } else {
+        rows.push_back(row);
+        row.clear();
+      }
+    }
+  }
+  EXPECT_TRUE(row.empty());
+  return rows;
+}
+
+TEST(CsvParserTest, FieldBatchesMatchRows) {
+  const std::string text = make_mixed_csv(20000);
+  const CSV rows = parse_string(text);
+  for (const auto engine : {Engine::STATE_MACHINE, Engine::STRUCTURAL_INDEX}) {
+    for (const size_t capacity : {1, 3, 64, 4096}) {
+      CsvParser in_place = CsvParser(text.data(), text.size()).engine(engine);
+      EXPECT_EQ(read_field_batches(in_place, capacity), rows) << capacity;
+      // Refills in the middle of a batch
+      CsvParser trickled =
+          CsvParser(trickle_source(text, 7)).buffer_size(16).engine(engine);
+      EXPECT_EQ(read_field_batches(trickled, capacity), rows) << capacity;
+      CsvParser buffered =
+          CsvParser(trickle_source(text, 1000)).buffer_size(256).engine(engine);
+      EXPECT_EQ(read_field_batches(buffered, capacity), rows) << capacity;
+    }
+  }
+
+  for (const size_t capacity : {1, 2, 64}) {
+    CsvParser projected = CsvParser(trickle_source(text, 7))
+                              .buffer_size(16)
+                              .select_columns({2, 0});
+    EXPECT_EQ(read_field_batches(projected, capacity), project(rows, {0, 2}));
+
+    const Predicate predicate = Predicate::starts_with("q");
+    CsvParser filtered =
+        CsvParser(trickle_source(text, 7)).buffer_size(16).where(1, predicate);
+    EXPECT_EQ(read_field_batches(filtered, capacity),
+              filter(rows, 1, predicate));
+  }
+
+  // Whole rows per batch while they fit, and a ROW_END for a last row
+  // without a terminator
+  const std::string small = "a,b\nc,d,e\nf";
+  CsvParser parser(small.data(), small.size());
+  FieldView fields[4];
+  ASSERT_EQ(parser.next_fields(fields, 4), 4u);
+  EXPECT_EQ(fields[1].str(), "b");
+  EXPECT_EQ(fields[2].type, FieldType::ROW_END);
+  EXPECT_EQ(fields[3].str(), "c");
+  ASSERT_EQ(parser.next_fields(fields, 4), 4u);
+  EXPECT_EQ(fields[2].type, FieldType::ROW_END);
+  EXPECT_EQ(fields[3].str(), "f");
+  ASSERT_EQ(parser.next_fields(fields, 4), 1u);
+  EXPECT_EQ(fields[0].type, FieldType::ROW_END);
+  EXPECT_EQ(parser.next_fields(fields, 4), 0u);
+  EXPECT_THROW(parser.next_fields(fields, 0), std::invalid_argument);
+}
@@ -2,8 +2,14 @@
 
 #include <rapidcheck.h>
 
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 
 using namespace aria::csv;
 
@@ -56,6 +62,26 @@ auto write_csv(const CSV &rows) -> std::string {
   return out;
 }
 
+auto read_fields(CsvParser &p) -> std::vector<std::pair<FieldType, std::string>> {
+  std::vector<std::pair<FieldType, std::string>> fields;
+  for (;;) {
+    auto field = p.next_field();
+    fields.emplace_back(field.type, std::move(field.data));
+    if (field.type == FieldType::CSV_END) {
+      return fields;
+    }
+  }
+}
+
+auto engines_agree(const std::string &text) -> bool {
+  std::istringstream fsm_input(text);
+  CsvParser fsm(fsm_input);
+  std::istringstream indexed_input(text);
+  CsvParser indexed =
+      CsvParser(indexed_input).engine(Engine::STRUCTURAL_INDEX);
+  return read_fields(fsm) == read_fields(indexed);
+}
+
 auto has_no_zero_field_rows(const CSV &rows) -> bool {
   for (const auto &row : rows) {
     if (row.empty()) {
@@ -65,6 +91,15 @@ auto has_no_zero_field_rows(const CSV &rows) -> bool {
   return true;
 }
 
+auto read_typed(const std::string &text, ColumnType type) -> TypedValue {
+  std::istringstream input(text);
+  CsvParser parser(input);
+  TypedReader reader(parser, {type});
+  std::vector<TypedValue> row;
+  reader.next_row(row);
+  return row.at(0);
+}
+
 } // namespace
 
 int main() {
@@ -79,5 +114,54 @@ int main() {
               RC_ASSERT(read_all(parser) == rows);
             });
 
+  rc::check("CsvWriter output round-trips through CsvParser",
+            [](const CSV &rows) {
+              RC_PRE(has_no_zero_field_rows(rows));
+
+              std::ostringstream output;
+              {
+                CsvWriter writer(output);
+                for (const auto &row : rows) {
+                  writer.write_row(row);
+                }
+              }
+              const std::string text = output.str();
+              CsvParser parser(text.data(), text.size());
+
+              RC_ASSERT(read_all(parser) == rows);
+            });
+
+  rc::check("Structural index engine matches the state machine on tables",
+            [](const CSV &rows) {
+              RC_PRE(has_no_zero_field_rows(rows));
+              RC_ASSERT(engines_agree(write_csv(rows)));
+            });
+
+  rc::check("Structural index engine matches the state machine on any input",
+            [](const std::string &text) { RC_ASSERT(engines_agree(text)); });
+
+  rc::check("count_rows() matches the iterator on any input",
+            [](const std::string &text) {
+              std::istringstream input(text);
+              CsvParser rows(input);
+              CsvParser counted(text.data(), text.size());
+              RC_ASSERT(counted.count_rows() == read_all(rows).size());
+            });
+
+  rc::check("INT64 columns read back every int64 value", [](int64_t value) {
+    RC_ASSERT(read_typed(std::to_string(value), ColumnType::INT64).integer ==
+              value);
+  });
+
+  rc::check("DOUBLE columns read doubles exactly like strtod", [](double value) {
+    RC_PRE(std::isfinite(value));
+    for (const auto *format : {"%.17g", "%.6g", "%.3f", "%.10e"}) {
+      char text[64];
+      std::snprintf(text, sizeof(text), format, value);
+      RC_ASSERT(read_typed(text, ColumnType::DOUBLE).real ==
+                std::strtod(text, nullptr));
+    }
+  });
+
   return 0;
 }